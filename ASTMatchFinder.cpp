@@ -21,6 +21,7 @@
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/Support/Timer.h"
 #include <deque>
@@ -296,13 +297,23 @@ class MatchASTVisitor : public RecursiveASTVisitor<MatchASTVisitor>,
 public:
   MatchASTVisitor(const MatchFinder::MatchersByType *Matchers,
                   const MatchFinder::MatchFinderOptions &Options)
-      : Matchers(Matchers), Options(Options), ActiveASTContext(nullptr) {}
+      : Matchers(Matchers), Options(Options), ActiveASTContext(nullptr),
+        AnnotatedFiles(nullptr), TraverseStatements(true) {}
 
   ~MatchASTVisitor() override {
+    flushProfiling();
+  }
 
-    if (Options.CheckProfiling) {
-     // Options.CheckProfiling->Records = std::move(TimeByBucket);
-    }
+  /// \brief Adds the time spent in each callback to the records passed with
+  /// \c MatchFinderOptions::CheckProfiling and starts again from zero.
+  void flushProfiling() {
+    if (!Options.CheckProfiling)
+      return;
+
+    for (auto &Bucket : TimeByBucket)
+      Options.CheckProfiling->Records[Bucket.getKey()] += Bucket.getValue();
+
+    TimeByBucket.clear();
   }
 
   void onStartOfTranslationUnit() {
@@ -329,6 +340,18 @@ public:
     ActiveASTContext = NewActiveASTContext;
   }
 
+  /// \brief Only match declarations expanded from the main file or one of
+  /// \p Files, a null \p Files matches declarations from every file.
+  void set_location_filter(const llvm::DenseSet<FileID> *Files) {
+    AnnotatedFiles = Files;
+  }
+
+  /// \brief Statements are only traversed when a statement matcher can use
+  /// them, otherwise function bodies and initializers are skipped.
+  void set_traverse_statements(bool Traverse) {
+    TraverseStatements = Traverse;
+  }
+
   // The following Visit*() and Traverse*() functions "override"
   // methods in RecursiveASTVisitor.
 
@@ -749,6 +772,26 @@ private:
   const MatchFinder::MatchFinderOptions &Options;
   ASTContext *ActiveASTContext;
 
+  const llvm::DenseSet<FileID> *AnnotatedFiles;
+  bool TraverseStatements;
+
+  // Returns true if \p DeclNode is outside the files set by
+  // set_location_filter(). Declarations that only group other declarations
+  // are never pruned since their children can come from another file.
+  bool isPrunedByLocation(const Decl &DeclNode) const {
+    if (!AnnotatedFiles || isa<TranslationUnitDecl>(DeclNode) ||
+        isa<NamespaceDecl>(DeclNode) || isa<LinkageSpecDecl>(DeclNode))
+      return false;
+
+    const SourceManager &SM = ActiveASTContext->getSourceManager();
+    SourceLocation Loc = DeclNode.getLocation();
+    if (Loc.isInvalid())
+      return false;
+
+    FileID File = SM.getFileID(SM.getExpansionLoc(Loc));
+    return File != SM.getMainFileID() && !AnnotatedFiles->count(File);
+  }
+
   // Maps a canonical type to its TypedefDecls.
   llvm::DenseMap<const Type*, std::set<const TypedefNameDecl*> > TypeAliases;
 
@@ -815,7 +858,7 @@ bool MatchASTVisitor::classIsDerivedFrom(const CXXRecordDecl *Declaration,
 }
 
 bool MatchASTVisitor::TraverseDecl(Decl *DeclNode) {
-  if (!DeclNode) {
+  if (!DeclNode || isPrunedByLocation(*DeclNode)) {
     return true;
   }
   match(*DeclNode);
@@ -823,7 +866,7 @@ bool MatchASTVisitor::TraverseDecl(Decl *DeclNode) {
 }
 
 bool MatchASTVisitor::TraverseStmt(Stmt *StmtNode) {
-  if (!StmtNode) {
+  if (!StmtNode || !TraverseStatements) {
     return true;
   }
   match(*StmtNode);
@@ -904,6 +947,7 @@ void MatchASTConsumer::addMatcher(const StatementMatcher &NodeMatch,
                              MatchFinder::MatchCallback *Action) {
   Matchers.DeclOrStmt.emplace_back(NodeMatch, Action);
   Matchers.AllCallbacks.insert(Action);
+  HasStatementMatchers = true;
 }
 
 void MatchASTConsumer::addMatcher(const NestedNameSpecifierMatcher &NodeMatch,
@@ -956,9 +1000,9 @@ std::unique_ptr<clang::ASTConsumer> MatchFinder::newASTConsumer()
 }
 */
 MatchASTConsumer::MatchASTConsumer(clang::ASTContext& astContext) :
-  ActiveASTContext(astContext)
+  ActiveASTContext(astContext), AnnotatedFiles(nullptr), HasStatementMatchers(false)
 {
-  MatchFinder::MatchFinderOptions Options = MatchFinder::MatchFinderOptions();
+  //the visitor keeps a reference to the options so they have to live as long as it does
   Visitor = new MatchASTVisitor(&Matchers, Options);
 
   auto visitor = reinterpret_cast<MatchASTVisitor*>(Visitor);
@@ -977,6 +1021,7 @@ void MatchASTConsumer::HandleTranslationUnit(ASTContext &Context)
   auto visitor = reinterpret_cast<MatchASTVisitor*>(Visitor);
 
   visitor->onStartOfTranslationUnit();
+  visitor->flushProfiling();
 }
 
 bool MatchASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef d)
@@ -988,6 +1033,8 @@ bool MatchASTConsumer::HandleTopLevelDecl(clang::DeclGroupRef d)
   auto end = d.end();
 
   visitor->set_active_ast_context(&ActiveASTContext);
+  visitor->set_location_filter(AnnotatedFiles);
+  visitor->set_traverse_statements(HasStatementMatchers);
 
   for (; it != end; it++) {
     visitor->TraverseDecl(*it);
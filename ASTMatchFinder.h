@@ -3,7 +3,11 @@
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Timer.h"
 #include <Vector>
+#include <memory>
 
 namespace clang{
   
@@ -32,6 +36,22 @@ public:
 
   bool addDynamicMatcher(const internal::DynTypedMatcher & NodeMatch, MatchFinder::MatchCallback * Action);
 
+  /*Only match declarations expanded from the main file or one of the files in annotatedFiles, the set can 
+    keep growing while the file is parsed */
+  void setLocationFilter(const llvm::DenseSet<FileID>* annotatedFiles){
+    AnnotatedFiles = annotatedFiles;
+  }
+
+  /*Add the time spent in each callback keyed by its getID to records at the end of each translation unit*/
+  void enableProfiling(llvm::StringMap<llvm::TimeRecord>& records){
+    Options.CheckProfiling.emplace(records);
+  }
+
+  /*Delete the callback when the consumer is destroyed*/
+  void takeCallbackOwnership(MatchFinder::MatchCallback* callback){
+    OwnedCallbacks.emplace_back(callback);
+  }
+
 private:
   /*Visit declarations as there parsed instead after the whole file is parsed loading macro context */
   bool HandleTopLevelDecl(clang::DeclGroupRef d) override;
@@ -40,7 +60,11 @@ private:
   void* Visitor;
   clang::ASTContext& ActiveASTContext;
   MatchFinder::MatchersByType Matchers;
+  MatchFinder::MatchFinderOptions Options;
   MatchFinder::ParsingDoneTestCallback *ParsingDone;
+  const llvm::DenseSet<FileID>* AnnotatedFiles;
+  bool HasStatementMatchers;
+  std::vector<std::unique_ptr<MatchFinder::MatchCallback>> OwnedCallbacks;
 };
 
 }
@@ -0,0 +1,624 @@
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Tooling/Tooling.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include "MacroRecorder.h"
+#include "LibRegBuilder.h"
+#include "FastFunctionCollector.h"
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+using namespace llvm;
+using std::string;
+using std::unique_ptr;
+
+typedef std::chrono::steady_clock BenchClock;
+
+static uint64_t ElapsedNs(BenchClock::time_point start){
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now()-start).count();
+}
+
+//Time spent in one kind of callback over a single parse
+struct CallbackTotal{
+  CallbackTotal() : Time(0), Count(0){
+  }
+
+  uint64_t Time;
+  unsigned Count;
+};
+
+//Times each LJFF_ directive by its keyword so one synthetic source can measure the kind its built around
+class TimedMacroRecorder : public MacroRecorder{
+
+public:
+  TimedMacroRecorder(clang::CompilerInstance& ci, RecorderCollection* collector, llvm::StringMap<CallbackTotal>& totals) :
+    MacroRecorder(ci, collector, false), Totals(totals){
+  }
+
+  void MacroExpands(const clang::Token &macroNameTok, const clang::MacroDefinition &MD, clang::SourceRange range, const clang::MacroArgs *args) override{
+
+    BenchClock::time_point start = BenchClock::now();
+    MacroRecorder::MacroExpands(macroNameTok, MD, range, args);
+    uint64_t time = ElapsedNs(start);
+
+    CallbackTotal& total = Totals[macroNameTok.getIdentifierInfo()->getName()];
+    total.Time += time;
+    total.Count++;
+  }
+
+private:
+  llvm::StringMap<CallbackTotal>& Totals;
+};
+
+//Times the consumer that binds recorders to functions, this is where LuaCFunctionDefined and GetFieldInfo run
+class TimedBindConsumer : public clang::ASTConsumer{
+
+public:
+  TimedBindConsumer(clang::ASTConsumer* consumer, CallbackTotal& total) : Consumer(consumer), Total(total){
+  }
+
+  void Initialize(clang::ASTContext& context) override{
+    Consumer->Initialize(context);
+  }
+
+  bool HandleTopLevelDecl(clang::DeclGroupRef d) override{
+    BenchClock::time_point start = BenchClock::now();
+    bool result = Consumer->HandleTopLevelDecl(d);
+    Total.Time += ElapsedNs(start);
+    Total.Count++;
+    return result;
+  }
+
+  void HandleTranslationUnit(clang::ASTContext& context) override{
+    BenchClock::time_point start = BenchClock::now();
+    Consumer->HandleTranslationUnit(context);
+    Total.Time += ElapsedNs(start);
+  }
+
+private:
+  unique_ptr<clang::ASTConsumer> Consumer;
+  CallbackTotal& Total;
+};
+
+class BenchParseAction : public clang::ASTFrontendAction{
+
+public:
+  BenchParseAction(RecorderCollection* recorders, llvm::StringMap<CallbackTotal>& directiveTotals, CallbackTotal& bindTotal) :
+    Recorders(recorders), DirectiveTotals(directiveTotals), BindTotal(bindTotal){
+  }
+
+  unique_ptr<clang::ASTConsumer> CreateASTConsumer(clang::CompilerInstance &CI, StringRef InFile) override{
+    CI.getPreprocessor().addPPCallbacks(std::make_unique<TimedMacroRecorder>(CI, Recorders, DirectiveTotals));
+    Recorders->NewSourceFile();
+
+    return std::make_unique<TimedBindConsumer>(GetASTConsumer(CI, Recorders, false), BindTotal);
+  }
+
+private:
+  RecorderCollection* Recorders;
+  llvm::StringMap<CallbackTotal>& DirectiveTotals;
+  CallbackTotal& BindTotal;
+};
+
+static size_t CountBoundFunctions(const RecorderCollection& records){
+
+  size_t count = 0;
+
+  for(auto& object : records.ObjectFunctions){
+    count += object.getValue()->MemberFunctions.size() + object.getValue()->MetaFunctions.size();
+  }
+
+  return count;
+}
+
+//Declarations every synthetic source starts with, the directives expand to nothing like they do in LuaJIT
+static const char* SourcePrelude =
+  "struct lua_State;\n"
+  "#define LJFF_ALIAS(...)\n"
+  "#define LJFF_MODULE(...)\n"
+  "#define LJFF_NEEDSFLAG(...)\n"
+  "#define LJFF_NOEXTERN(...)\n"
+  "#define LJFF_PUSH(...)\n"
+  "#define LJFF_REC(...)\n"
+  "#define LJFF_REC_GETFIELD(...)\n"
+  "#define LJFF_REC_SETFIELD(...)\n\n";
+
+//A struct with fieldCount int fields named field0 to fieldN
+static void WriteBenchStruct(std::ostream& source, unsigned fieldCount){
+
+  source << "struct Bench{\n";
+
+  for(unsigned i = 0; i != fieldCount ;i++){
+    source << "  int field" << i << ";\n";
+  }
+
+  source << "};\n\n";
+}
+
+//Every function is on the same line as its directives since thats how a recorder gets bound to it
+static string GenerateDirectiveSource(StringRef kind, unsigned count){
+
+  std::ostringstream source;
+  source << SourcePrelude;
+
+  if(kind == "REC_GETFIELD"){
+    WriteBenchStruct(source, 32);
+  }
+
+  for(unsigned i = 0; i != count ;i++){
+    if(kind == "REC"){
+      //alternate between the implicit recorder name and a named recorder with packed options
+      if(i & 1){
+        source << "LJFF_REC(bench_recorder, " << i << ", (" << (i & 15) << "+1)) ";
+      }else{
+        source << "LJFF_REC(.) ";
+      }
+      source << "int Bench_func" << i << "(lua_State* L){ return 0; }\n";
+    }else if(kind == "PUSH"){
+      source << "LJFF_PUSH(\"upvalue" << i << "\") LJFF_PUSH(base+" << (i & 7) << ") LJFF_REC(.) int Bench_func" << i << "(lua_State* L){ return 0; }\n";
+    }else if(kind == "ALIAS"){
+      source << "LJFF_ALIAS(alias" << i << ", top-" << (i & 7) << ")\n";
+    }else if(kind == "REC_GETFIELD"){
+      source << "LJFF_REC_GETFIELD(field" << (i & 31) << ") int Bench_get" << i << "(lua_State* L){ return 0; }\n";
+    }
+  }
+
+  return source.str();
+}
+
+//functionCount getters spread evenly over a struct of fieldCount fields
+static string GenerateBindSource(unsigned fieldCount, unsigned functionCount, bool getField){
+
+  std::ostringstream source;
+  source << SourcePrelude;
+  WriteBenchStruct(source, fieldCount);
+
+  for(unsigned i = 0; i != functionCount ;i++){
+    if(getField){
+      source << "LJFF_REC_GETFIELD(field" << ((i*7919) % fieldCount) << ") ";
+    }else{
+      source << "LJFF_REC(.) ";
+    }
+    source << "int Bench_get" << i << "(lua_State* L){ return 0; }\n";
+  }
+
+  return source.str();
+}
+
+//Parse the source once with the timed recorder and binding consumer, returns false if it didn't parse
+static bool ParseBenchSource(const string& source, llvm::StringMap<CallbackTotal>& directiveTotals, CallbackTotal& bindTotal, size_t& boundFunctions){
+
+  RecorderCollection records(false);
+
+  bool parsed = clang::tooling::runToolOnCodeWithArgs(new BenchParseAction(&records, directiveTotals, bindTotal), source,
+                                                      {"-std=c++11", "-w"}, "bench_source.cpp");
+
+  boundFunctions = CountBoundFunctions(records);
+
+  return parsed;
+}
+
+BenchmarkRunner::BenchmarkRunner(unsigned repeatCount, StringRef filter) : RepeatCount(std::max(repeatCount, 1u)), Filter(filter), Failed(false){
+}
+
+bool BenchmarkRunner::IsEnabled(StringRef name) const{
+  return Filter.empty() || name.find(Filter) != StringRef::npos;
+}
+
+void BenchmarkRunner::AddResult(StringRef name, const BenchmarkParams& params, uint64_t items, std::vector<uint64_t> times, uint64_t bytes,
+                                const BenchmarkMetrics& metrics){
+
+  std::sort(times.begin(), times.end());
+
+  BenchmarkResult result;
+  result.Name = name.str();
+  result.Params = params;
+  result.Metrics = metrics;
+  result.Items = items;
+  result.Bytes = bytes;
+  result.BestNs = times.front();
+  result.MedianNs = times[times.size()/2];
+
+  std::cout << std::left << std::setw(44) << result.GetFullName() << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << (result.MedianNs/(double)std::max<uint64_t>(items, 1)) << " ns/item"
+            << std::setw(14) << std::setprecision(0) << (items/(result.MedianNs/1e9)) << " items/s";
+
+  for(auto& metric : metrics){
+    std::cout << "  " << metric.first << "=" << std::setprecision(2) << metric.second;
+  }
+
+  std::cout << "\n";
+
+  Results.push_back(std::move(result));
+}
+
+void BenchmarkRunner::ReportFailure(StringRef name, StringRef reason){
+  std::cout << name.str() << ": " << reason.str() << "\n";
+  Failed = true;
+}
+
+string BenchmarkResult::GetFullName() const{
+
+  string fullName = Name;
+
+  for(auto& param : Params){
+    fullName += "/" + param.first + "=" + std::to_string(param.second);
+  }
+
+  return fullName;
+}
+
+//MacroRecorder::MacroExpands for each directive kind, the time only includes our callback not the preprocessor
+void BenchmarkRunner::RunDirectiveBenchmarks(unsigned scale){
+
+  static const char* kinds[] = {"REC", "PUSH", "ALIAS", "REC_GETFIELD"};
+
+  for(const char* kind : kinds){
+    string name = string("directive/") + kind;
+
+    if(!IsEnabled(name)){
+      continue;
+    }
+
+    unsigned count = 4000*scale;
+    string source = GenerateDirectiveSource(kind, count);
+    string macroName = string("LJFF_") + kind;
+    std::vector<uint64_t> times;
+    uint64_t directiveCount = 0;
+
+    for(unsigned i = 0; i != RepeatCount ;i++){
+      llvm::StringMap<CallbackTotal> directiveTotals;
+      CallbackTotal bindTotal;
+      size_t boundFunctions;
+
+      if(!ParseBenchSource(source, directiveTotals, bindTotal, boundFunctions)){
+        ReportFailure(name, "synthetic source failed to parse");
+        break;
+      }
+
+      times.push_back(directiveTotals[macroName].Time);
+      directiveCount = directiveTotals[macroName].Count;
+    }
+
+    if(times.size() == RepeatCount){
+      AddResult(name, {{"directives", directiveCount}}, directiveCount, times);
+    }
+  }
+}
+
+//Binding recorders to functions, REC_GETFIELD also looks the field up in the struct so it grows with the struct
+void BenchmarkRunner::RunBindBenchmarks(unsigned scale){
+
+  static const unsigned fieldCounts[] = {8, 64, 512};
+  unsigned functionCount = 2000*scale;
+
+  for(int getField = 0; getField != 2 ;getField++){
+    string name = getField ? "bind/REC_GETFIELD" : "bind/REC";
+
+    if(!IsEnabled(name)){
+      continue;
+    }
+
+    for(unsigned fieldCount : fieldCounts){
+      string source = GenerateBindSource(fieldCount, functionCount, getField != 0);
+      std::vector<uint64_t> times;
+
+      for(unsigned i = 0; i != RepeatCount ;i++){
+        llvm::StringMap<CallbackTotal> directiveTotals;
+        CallbackTotal bindTotal;
+        size_t boundFunctions;
+
+        if(!ParseBenchSource(source, directiveTotals, bindTotal, boundFunctions)){
+          ReportFailure(name, "synthetic source failed to parse");
+          break;
+        }
+
+        if(boundFunctions != functionCount){
+          ReportFailure(name, "only " + std::to_string(boundFunctions) + " of " + std::to_string(functionCount) + " functions were bound");
+          break;
+        }
+
+        times.push_back(bindTotal.Time);
+      }
+
+      if(times.size() == RepeatCount){
+        AddResult(name, {{"fields", fieldCount}, {"functions", functionCount}}, functionCount, times);
+      }
+    }
+  }
+}
+
+//Fill a collection the same way binding would with objectCount objects of functionsPerObject functions each,
+//every 8th one is a metamethod
+static void BuildEmitRecords(RecorderCollection& records, unsigned objectCount, unsigned functionsPerObject){
+
+  for(unsigned object = 0; object != objectCount ;object++){
+    string objectName = "Object" + std::to_string(object);
+    auto objectData = records.GetArena().NewObject(objectName);
+
+    objectData->ObjectType = (object % 4) == 0 ? Object_CData : Object_Userdata;
+    records.ObjectFunctions[objectName] = objectData;
+
+    for(unsigned i = 0; i != functionsPerObject ;i++){
+      auto entry = records.GetArena().NewRecord();
+      bool meta = (i % 8) == 7;
+
+      entry->FunctionId = (int)records.AllFunctions.size();
+      entry->RecordOptions = "0";
+      entry->TraceRecorder = ".";
+      entry->SetFunctionName(objectName + (meta ? "___index" : "_func") + std::to_string(i));
+
+      if(i & 1){
+        entry->PushStack.push_back(PushEntry(PushType_MemberTable));
+        entry->NeedsMembersTable = true;
+      }
+
+      if((i % 3) == 0){
+        entry->PushStack.push_back(PushEntry(records.GetArena().SaveString("upvalue")));
+      }
+
+      if((i % 5) == 0){
+        entry->RequiredFlag = "BenchFlag";
+      }
+
+      records.AllFunctions.push_back(entry);
+
+      if(meta){
+        objectData->AddMetaFunction(entry);
+      }else{
+        objectData->AddMemberFunction(entry);
+      }
+    }
+  }
+}
+
+//Building the RecorderTable and each of LibRegBuilder's emitters writing it to a temporary file, the file size is reported so 
+//bytes/s and the difference in generated code size can be worked out.
+//Only the first run of each size replaces the file, the others find it unchanged the same as an incremental build would
+void BenchmarkRunner::RunEmitBenchmarks(unsigned scale){
+
+  static const unsigned objectCounts[] = {250, 1000, 4000};
+  const unsigned functionsPerObject = 8;
+
+  static const char* emitterNames[] = {"emit/WriteLibReg", "emit/WriteLibRegTables", "emit/WriteLibRegStream"};
+
+  std::vector<string> includes = {"lj_obj.h", "lj_lib.h"};
+
+  for(unsigned emitter = 0; emitter != 3 ;emitter++){
+    StringRef name = emitterNames[emitter];
+
+    if(!IsEnabled(name)){
+      continue;
+    }
+
+    llvm::SmallString<128> outputPath;
+
+    if(llvm::sys::fs::createTemporaryFile("buildvm_clang-bench", "cpp", outputPath)){
+      ReportFailure(name, "failed to create a temporary output file");
+      return;
+    }
+
+    for(unsigned objectCount : objectCounts){
+      objectCount *= scale;
+
+      RecorderCollection records(false);
+      BuildEmitRecords(records, objectCount, functionsPerObject);
+
+      std::vector<uint64_t> times;
+
+      for(unsigned i = 0; i != RepeatCount ;i++){
+        BenchClock::time_point start = BenchClock::now();
+        {
+          RecorderTable table(records);
+          LibRegBuilder regBuilder(table, outputPath.str());
+
+          if(emitter == 2){
+            regBuilder.WriteLibRegStream(includes);
+          }else if(emitter == 1){
+            regBuilder.WriteLibRegTables(includes);
+          }else{
+            regBuilder.WriteLibReg(includes);
+          }
+
+          regBuilder.SaveOutput();
+        }
+        times.push_back(ElapsedNs(start));
+      }
+
+      uint64_t fileSize = 0;
+      llvm::sys::fs::file_size(outputPath, fileSize);
+
+      AddResult(name, {{"objects", objectCount}, {"functions", objectCount*functionsPerObject}},
+                objectCount*functionsPerObject, times, fileSize);
+    }
+
+    llvm::sys::fs::remove(outputPath);
+  }
+}
+
+static void WriteJSONString(std::ostream& output, StringRef value){
+
+  output << '"';
+
+  for(char c : value){
+    if(c == '"' || c == '\\'){
+      output << '\\';
+    }
+    output << c;
+  }
+
+  output << '"';
+}
+
+bool BenchmarkRunner::WriteJSON(const string& path, unsigned scale) const{
+
+  std::ofstream output(path, std::ios::binary);
+
+  if(!output){
+    return false;
+  }
+
+  output << "{\n  \"version\": 1,\n  \"scale\": " << scale << ",\n  \"repeat\": " << RepeatCount << ",\n  \"benchmarks\": [";
+
+  bool first = true;
+
+  for(auto& result : Results){
+    output << (first ? "\n" : ",\n") << "    {\"name\": ";
+    WriteJSONString(output, result.GetFullName());
+    output << ", \"group\": ";
+    WriteJSONString(output, result.Name);
+    output << ", \"params\": {";
+
+    for(size_t i = 0; i != result.Params.size() ;i++){
+      output << (i != 0 ? ", " : "");
+      WriteJSONString(output, result.Params[i].first);
+      output << ": " << result.Params[i].second;
+    }
+
+    output << "}, \"items\": " << result.Items << ", \"best_ns\": " << result.BestNs << ", \"median_ns\": " << result.MedianNs;
+    output << std::fixed << std::setprecision(3) << ", \"ns_per_item\": " << (result.MedianNs/(double)std::max<uint64_t>(result.Items, 1));
+
+    if(result.Bytes != 0){
+      output << ", \"bytes\": " << result.Bytes << ", \"bytes_per_sec\": " << std::setprecision(0) << (result.Bytes/(result.MedianNs/1e9));
+    }
+
+    for(auto& metric : result.Metrics){
+      output << ", ";
+      WriteJSONString(output, metric.first);
+      output << ": " << std::setprecision(3) << metric.second;
+    }
+
+    output << "}";
+    first = false;
+  }
+
+  output << "\n  ]\n}\n";
+
+  return output.good();
+}
+
+cl::opt<std::string> ResultsFile(
+  "o",
+  cl::desc("<path to write the results to as JSON>"),
+  cl::init("bench_results.json"));
+
+cl::opt<unsigned> Scale(
+  "scale",
+  cl::desc("<multiplier for the size of the synthetic inputs>"),
+  cl::init(1));
+
+cl::opt<unsigned> RepeatCount(
+  "repeat",
+  cl::desc("<number of times each benchmark is run, the median and best time are reported>"),
+  cl::init(5));
+
+cl::opt<std::string> Filter(
+  "filter",
+  cl::desc("<only run the benchmarks with names containing this>"),
+  cl::Optional);
+
+cl::opt<bool> RunCorpusBenchmark(
+  "corpus",
+  cl::desc("<also run the generator end to end over generated LuaJIT lib like corpora of growing size>"),
+  cl::Optional);
+
+cl::opt<std::string> GeneratorPath(
+  "generator",
+  cl::desc("<path of the buildvm_clang executable the corpus benchmark runs, defaults to the one next to this executable>"),
+  cl::Optional);
+
+cl::opt<std::string> CorpusDir(
+  "corpus-dir",
+  cl::desc("<directory to generate the corpora in, defaults to a temporary directory>"),
+  cl::Optional);
+
+cl::opt<unsigned> CorpusFileCount(
+  "corpus-files",
+  cl::desc("<number of lib source files in the smallest corpus>"),
+  cl::init(16));
+
+cl::opt<unsigned> CorpusFunctionCount(
+  "corpus-functions",
+  cl::desc("<number of fast functions in each lib source file of the smallest corpus>"),
+  cl::init(32));
+
+cl::opt<unsigned> CorpusHeaders(
+  "corpus-headers",
+  cl::desc("<number of shared headers every lib source file includes>"),
+  cl::init(8));
+
+cl::opt<unsigned> CorpusSteps(
+  "corpus-steps",
+  cl::desc("<number of times the number of files and then the number of functions is doubled>"),
+  cl::init(3));
+
+cl::opt<unsigned> CorpusJobs(
+  "corpus-j",
+  cl::desc("<-j passed to the generator>"),
+  cl::init(1));
+
+cl::list<std::string> GeneratorArgs(
+  "generator-arg",
+  cl::desc("<extra argument to pass to the generator like -decls-only, can be repeated>"),
+  cl::ZeroOrMore);
+
+static std::string GetDefaultGeneratorPath(const char* argv0){
+
+  static int StaticSymbol;
+  llvm::SmallString<256> path(llvm::sys::path::parent_path(llvm::sys::fs::getMainExecutable(argv0, &StaticSymbol)));
+
+#if defined(_WIN32)
+  llvm::sys::path::append(path, "buildvm_clang.exe");
+#else
+  llvm::sys::path::append(path, "buildvm_clang");
+#endif
+
+  return path.str();
+}
+
+int main(int argc, const char **argv){
+
+  cl::ParseCommandLineOptions(argc, argv, "buildvm_clang component benchmarks\n");
+
+  unsigned scale = std::max(Scale.getValue(), 1u);
+  BenchmarkRunner runner(RepeatCount, Filter);
+
+  runner.RunDirectiveBenchmarks(scale);
+  runner.RunBindBenchmarks(scale);
+  runner.RunEmitBenchmarks(scale);
+
+  if(RunCorpusBenchmark){
+    CorpusOptions corpus;
+    corpus.Generator = GeneratorPath.empty() ? GetDefaultGeneratorPath(argv[0]) : GeneratorPath;
+    corpus.CorpusDir = CorpusDir;
+    corpus.GeneratorArgs = GeneratorArgs;
+    corpus.Files = std::max(CorpusFileCount.getValue(), 1u);
+    corpus.FunctionsPerFile = std::max(CorpusFunctionCount.getValue(), 1u);
+    corpus.SharedHeaders = CorpusHeaders;
+    corpus.Steps = CorpusSteps;
+    corpus.JobCount = CorpusJobs;
+
+    runner.RunCorpusBenchmarks(corpus);
+  }
+
+  if(!runner.WriteJSON(ResultsFile, scale)){
+    std::cout << "Failed to write results to " << ResultsFile << "\n";
+    return 1;
+  }
+
+  return runner.HasFailed() ? 1 : 0;
+}
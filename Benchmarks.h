@@ -0,0 +1,78 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Size parameters of a benchmark run, they become part of its name like directive/REC/directives=4000
+typedef std::vector<std::pair<std::string, uint64_t>> BenchmarkParams;
+//Extra measurements a benchmark reports besides its times like files/s or peak RSS
+typedef std::vector<std::pair<std::string, double>> BenchmarkMetrics;
+
+struct BenchmarkResult{
+  std::string Name;
+  BenchmarkParams Params;
+  //number of directives, functions or objects processed in one run
+  uint64_t Items;
+  uint64_t BestNs, MedianNs;
+  //bytes written in one run, 0 when the benchmark produces no output
+  uint64_t Bytes;
+  BenchmarkMetrics Metrics;
+
+  std::string GetFullName() const;
+};
+
+//Shape of the generated LuaJIT lib like corpus the end to end benchmark runs the generator over
+struct CorpusOptions{
+  CorpusOptions() : Files(16), FunctionsPerFile(32), SharedHeaders(8), Steps(3), JobCount(1){
+  }
+
+  //path of the buildvm_clang executable to run
+  std::string Generator;
+  //directory to generate the corpus in, when empty a temporary one is used and removed afterwards
+  std::string CorpusDir;
+  //extra arguments passed to the generator before --
+  std::vector<std::string> GeneratorArgs;
+  //size of the smallest corpus, each step of the file and function sweeps doubles one of them
+  unsigned Files, FunctionsPerFile;
+  //headers every source file includes on top of its own module header
+  unsigned SharedHeaders;
+  unsigned Steps;
+  unsigned JobCount;
+};
+
+//Runs the component benchmarks over synthetic inputs. Each one is run repeatCount times and the results are
+//printed as a table and written as JSON so they can be tracked over time
+class BenchmarkRunner{
+
+public:
+  BenchmarkRunner(unsigned repeatCount, llvm::StringRef filter);
+
+  void RunDirectiveBenchmarks(unsigned scale);
+  void RunBindBenchmarks(unsigned scale);
+  void RunEmitBenchmarks(unsigned scale);
+  //Runs the whole generator as a child process over corpora of growing size
+  void RunCorpusBenchmarks(const CorpusOptions& options);
+
+  bool WriteJSON(const std::string& path, unsigned scale) const;
+
+  bool HasFailed() const{
+    return Failed;
+  }
+
+private:
+  bool IsEnabled(llvm::StringRef name) const;
+  bool RunCorpus(const CorpusOptions& options, const std::string& corpusDir, llvm::StringRef group, unsigned files, unsigned functionsPerFile,
+                 double& baseCost);
+  void AddResult(llvm::StringRef name, const BenchmarkParams& params, uint64_t items, std::vector<uint64_t> times, uint64_t bytes = 0,
+                 const BenchmarkMetrics& metrics = BenchmarkMetrics());
+  void ReportFailure(llvm::StringRef name, llvm::StringRef reason);
+
+  unsigned RepeatCount;
+  std::string Filter;
+  bool Failed;
+  std::vector<BenchmarkResult> Results;
+};
@@ -4,30 +4,44 @@
 #include "llvm/Support/CommandLine.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/MultiplexConsumer.h"
 #include "clang/Tooling/CompilationDatabase.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
 #include "clang/Tooling/Tooling.h"
+#include "clang/Basic/FileManager.h"
 
 #include "clang/Parse/ParseAST.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/DeclCXX.h"
 
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/ADT/SmallString.h"
 
 #include "MacroRecorder.h"
 #include "LibRegBuilder.h"
 #include "FastFunctionCollector.h"
+#include "ResultCache.h"
+#include "PrefixHeader.h"
+#include "SharedFileOverlay.h"
+#include "ToolChain.h"
+#include "Server.h"
+#include "TimeTrace.h"
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <thread>
 
 
 
 //using namespace clang;
-
-RecorderCollection* LJMacros = NULL;
-
-
-extern void AddClangSystemIncludeArgs(clang::HeaderSearchOptions& headerSearch, const std::string& windowsSDKVer, const char* vsVersion = NULL);
 
 
 using namespace clang::tooling;
@@ -36,23 +50,135 @@ using namespace llvm;
 using clang::CompilerInstance;
 using std::unique_ptr;
 
+//Settings shared by every ParseLJ action created for a run
+struct ParseSettings{
+  ParseSettings() : Verbose(false), DeclarationsOnly(false), UseMatchFinder(false), Prefix(NULL), FileSystem(NULL), ToolChain(NULL), Trace(NULL){
+  }
+
+  bool Verbose;
+  //bind recorders using the generic AST matcher instead of the specialized signature visitor
+  bool UseMatchFinder;
+  //Only the declarations of functions are needed to bind recorders so function bodies are skipped and 
+  //template parsing is delayed
+  bool DeclarationsOnly;
+  //precompiled prefix header shared by the source files that start with its includes
+  const PrefixHeader* Prefix;
+  //file system every FileManager is created over, NULL uses the real one
+  clang::vfs::FileSystem* FileSystem;
+  const ToolChainInfo* ToolChain;
+  //only set for -time-trace
+  TimeTrace* Trace;
+};
+
+//Options set on every compiler instance, the PCH is built with the same ones as the sources that use it
+//or clang will refuse to load it
+static void ConfigureCompiler(CompilerInstance& CI, const ParseSettings& settings){
+
+  CI.getPreprocessorOpts().addMacroDef("_CRT_SECURE_NO_WARNINGS");
+  
+  if(settings.ToolChain != NULL){
+    ApplyToolChain(*settings.ToolChain, CI.getHeaderSearchOpts());
+  }
+
+  clang::LangOptions* languageOptions = &CI.getLangOpts();
+
+  llvm::Triple triple(settings.ToolChain ? settings.ToolChain->Triple : GetDefaultToolChainTriple());
+  // languageOptions-
+  clang::CompilerInvocation::setLangDefaults(*languageOptions, clang::IK_CXX, triple, CI.getPreprocessorOpts(), clang::LangStandard::lang_cxx11);
+  //Triple( Triple:: Triple::x86
+#if defined(_MSC_VER)
+  languageOptions->MicrosoftMode = true;
+  languageOptions->MicrosoftExt = true;
+  languageOptions->MSCVersion = 1400;
+  languageOptions->MSBitfields = 1;
+  languageOptions->DelayedTemplateParsing = 1;
+#endif
+
+  if(settings.DeclarationsOnly){
+    CI.getFrontendOpts().SkipFunctionBodies = true;
+    languageOptions->DelayedTemplateParsing = 1;
+    
+    //we never need typo correction so let Sema skip the work for it, warnings are turned off on the command line
+    languageOptions->SpellChecking = 0;
+  }
+}
+
+//Count the function bodies in the main file that the parser skipped, noload_decls is used so nothing 
+//gets deserialized from a precompiled header
+static unsigned CountSkippedBodies(const clang::DeclContext* context, const clang::SourceManager& sm){
+
+  unsigned count = 0;
+
+  for(auto decl : context->noload_decls()){
+
+    if(!sm.isInMainFile(sm.getExpansionLoc(decl->getLocation()))){
+      continue;
+    }
+
+    if(auto func = dyn_cast<clang::FunctionDecl>(decl)){
+      count += func->hasSkippedBody() ? 1 : 0;
+    }else if(isa<clang::NamespaceDecl>(decl) || isa<clang::LinkageSpecDecl>(decl) || isa<clang::CXXRecordDecl>(decl)){
+      count += CountSkippedBodies(cast<clang::DeclContext>(decl), sm);
+    }
+  }
+
+  return count;
+}
+
+//Forwards to the consumer that binds recorders and adds up the time spent in it for -time-trace
+class TimedASTConsumer : public clang::ASTConsumer{
+
+public:
+  TimedASTConsumer(unique_ptr<clang::ASTConsumer> consumer, const TimeTrace* trace, uint64_t& total) : 
+    Consumer(std::move(consumer)), Trace(trace), Total(total){
+  }
+
+  void Initialize(clang::ASTContext& context) override{
+    Consumer->Initialize(context);
+  }
+
+  bool HandleTopLevelDecl(clang::DeclGroupRef d) override{
+    TimeTraceAccumulator timer(Trace, Total);
+    return Consumer->HandleTopLevelDecl(d);
+  }
+
+  void HandleTranslationUnit(clang::ASTContext& context) override{
+    TimeTraceAccumulator timer(Trace, Total);
+    Consumer->HandleTranslationUnit(context);
+  }
+
+private:
+  unique_ptr<clang::ASTConsumer> Consumer;
+  const TimeTrace* Trace;
+  uint64_t& Total;
+};
 
 class ParseLJ : public clang::FrontendAction{
 
 public:
   CompilerInstance* ci;
 
-  ParseLJ(bool verbose) :Verbose(verbose){
+  ParseLJ(RecorderCollection* recorders, const ParseSettings& settings, const PrefixHeader* prefix = NULL) : 
+    Recorders(recorders), Settings(settings), Prefix(prefix), Verbose(settings.Verbose), Recorder(NULL), BindTime(0){
   }
 
   unique_ptr<clang::ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override{
-    CI.getPreprocessor().addPPCallbacks(std::make_unique<MacroRecorder>(CI, LJMacros, Verbose));
+    //carry on with the aliases and extern state left by the directives in the prefix headers
+    const DirectiveState* prefixState = Prefix ? &Prefix->GetDirectiveState() : NULL;
+    auto recorder = std::make_unique<MacroRecorder>(CI, Recorders, Verbose, prefixState);
+    recorder->SetTimeTrace(Settings.Trace);
+    Recorder = recorder.get();
+    CI.getPreprocessor().addPPCallbacks(std::move(recorder));
 
-    LJMacros->NewSourceFile();
+    Recorders->NewSourceFile();
 
-    auto astconsumer = GetASTConsumer(CI, LJMacros, Verbose);
+    auto astconsumer = GetASTConsumer(CI, Recorders, Verbose, Settings.UseMatchFinder, Settings.Trace ? &MatcherTimes : NULL);
     currentConsumer.reset();
 
+    if(Settings.Trace != NULL){
+      return std::make_unique<TimedASTConsumer>(unique_ptr<clang::ASTConsumer>(astconsumer), Settings.Trace, BindTime);
+    }
+
     return unique_ptr<clang::ASTConsumer>(astconsumer);
   }
 
@@ -66,31 +192,38 @@ public:
     if (!CI.hasSema())
       CI.createSema(getTranslationUnitKind(), NULL);
 
+    llvm::TimeRecord parseTime;
+    parseTime -= llvm::TimeRecord::getCurrentTime(true);
+    uint64_t parseStart = Settings.Trace ? Settings.Trace->Now() : 0;
+
     ParseAST(CI.getSema(), CI.getFrontendOpts().ShowStats, CI.getFrontendOpts().SkipFunctionBodies);
+
+    parseTime += llvm::TimeRecord::getCurrentTime(false);
+
+    if(Settings.Trace != NULL){
+      AddParseTrace(parseStart, Settings.Trace->Now());
+    }
+
+    if(Verbose){
+      std::cout << getCurrentFile().str() << ": " << Recorder->GetHandledExpansions() << " directives, skipped "
+                << Recorder->GetSkippedExpansions() << " other macro expansions\n";
+    }
+
+    if(Verbose && Settings.DeclarationsOnly){
+      unsigned skipped = CountSkippedBodies(CI.getASTContext().getTranslationUnitDecl(), CI.getSourceManager());
+
+      std::cout << getCurrentFile().str() << ": parsed in " << (parseTime.getWallTime()*1000) << "ms, skipped " 
+                << skipped << " function bodies\n";
+    }
   }
 
   virtual bool BeginInvocation(CompilerInstance &CI) override{ 
 
-    CI.getPreprocessorOpts().addMacroDef("_CRT_SECURE_NO_WARNINGS");
-    
-    AddClangSystemIncludeArgs(CI.getHeaderSearchOpts(), "v7.0A", "8.0");//"v7.0A");
-
-    clang::LangOptions* languageOptions = &CI.getLangOpts();
+    ConfigureCompiler(CI, Settings);
 
-    llvm::Triple triple;
-    triple.setArch(Triple::x86);
-    triple.setOS(Triple::Win32);
-    triple.setVendor(Triple::PC);
-    // languageOptions-
-    clang::CompilerInvocation::setLangDefaults(*languageOptions, clang::IK_CXX, triple, CI.getPreprocessorOpts(), clang::LangStandard::lang_cxx11);
-    //Triple( Triple:: Triple::x86
-#if defined(_MSC_VER)
-    languageOptions->MicrosoftMode = true;
-    languageOptions->MicrosoftExt = true;
-    languageOptions->MSCVersion = 1400;
-    languageOptions->MSBitfields = 1;
-    languageOptions->DelayedTemplateParsing = 1;
-#endif
+    if(Prefix != NULL){
+      CI.getPreprocessorOpts().ImplicitPCHInclude = Prefix->GetPCHPath();
+    }
 
     return true; 
   }
@@ -100,29 +233,319 @@ public:
   }
 
 private:
+  //Preprocessing and Sema are interleaved by ParseAST so they can only be timed together, the directive
+  //and binding time is taken out of them since its spent in our own callbacks
+  void AddParseTrace(uint64_t start, uint64_t end){
+
+    TimeTrace* trace = Settings.Trace;
+    uint64_t directiveTime = Recorder->GetDirectiveTime();
+
+    trace->AddEvent("Parse", getCurrentFile(), start, end, {{"Directives (us)", directiveTime}, {"Bind recorders (us)", BindTime},
+                    {"Skipped macro callbacks", Recorder->GetSkippedExpansions()}});
+    trace->AddPhaseTime("Preprocess and Sema", (end-start)-std::min(end-start, directiveTime+BindTime));
+    trace->AddPhaseTime("Directives", directiveTime);
+    trace->AddPhaseTime("Bind recorders", BindTime);
+
+    for(auto& matcher : MatcherTimes){
+      trace->AddPhaseTime(("Matcher " + matcher.getKey()).str(), (uint64_t)(matcher.getValue().getWallTime()*1000000));
+    }
+  }
+
+  RecorderCollection* Recorders;
+  const ParseSettings& Settings;
+  const PrefixHeader* Prefix;
   bool Verbose;
   unique_ptr<clang::ASTConsumer> currentConsumer;
+
+  MacroRecorder* Recorder;
+  uint64_t BindTime;
+  llvm::StringMap<llvm::TimeRecord> MatcherTimes;
 };
 
-class LJFrontendActionFactory : public FrontendActionFactory {
+//Builds the precompiled prefix header while recording the directives in the headers it includes the same
+//way ParseLJ does for a source file
+class BuildPrefixLJ : public clang::GeneratePCHAction{
+
+public:
+  BuildPrefixLJ(PrefixHeader& prefix, RecorderCollection* recorders, const ParseSettings& settings) : 
+    Prefix(prefix), Recorders(recorders), Settings(settings), Recorder(NULL){
+  }
+
+  unique_ptr<clang::ASTConsumer> CreateASTConsumer(CompilerInstance &CI, StringRef InFile) override{
+
+    std::vector<unique_ptr<clang::ASTConsumer>> consumers;
+    consumers.push_back(GeneratePCHAction::CreateASTConsumer(CI, InFile));
+
+    if(!consumers.back()){
+      return nullptr;
+    }
+
+    auto recorder = std::make_unique<MacroRecorder>(CI, Recorders, Settings.Verbose);
+    Recorder = recorder.get();
+    CI.getPreprocessor().addPPCallbacks(std::move(recorder));
+
+    Recorders->NewSourceFile();
+    consumers.emplace_back(GetASTConsumer(CI, Recorders, Settings.Verbose, Settings.UseMatchFinder));
+
+    return std::make_unique<clang::MultiplexConsumer>(std::move(consumers));
+  }
+
+  bool BeginInvocation(CompilerInstance &CI) override{
+    ConfigureCompiler(CI, Settings);
+    CI.getFrontendOpts().OutputFile = Prefix.GetPCHPath();
+    return true;
+  }
+
+  void EndSourceFileAction() override{
+
+    if(Recorder != NULL){
+      //the generated header is not an input of the run so keep it out of the dependencies
+      auto& files = Recorders->IncludedFiles;
+      files.erase(std::remove(files.begin(), files.end(), Prefix.GetHeaderPath()), files.end());
+
+      Prefix.SetBuildResult(*Recorders, Recorder->GetDirectiveState());
+    }
+
+    GeneratePCHAction::EndSourceFileAction();
+  }
+
+private:
+  PrefixHeader& Prefix;
+  RecorderCollection* Recorders;
+  const ParseSettings& Settings;
+  MacroRecorder* Recorder;
+};
+
+static std::vector<std::string> GetParseCommandLine(const CompileCommand& command, const ParseSettings& settings){
+
+  static int StaticSymbol;
+  static const std::string mainExecutable = llvm::sys::fs::getMainExecutable("buildvm_clang", &StaticSymbol);
+
+  ArgumentsAdjuster stripOutput = getClangStripOutputAdjuster();
+  ArgumentsAdjuster syntaxOnly = getClangSyntaxOnlyAdjuster();
+
+  std::vector<std::string> commandLine = syntaxOnly(stripOutput(command.CommandLine));
+  commandLine[0] = mainExecutable;
+
+  //parse for the triple the toolchain was resolved for since its the only target thats initialized
+  if(settings.ToolChain != NULL){
+    commandLine.insert(commandLine.begin()+1, {"-target", settings.ToolChain->Triple});
+  }
+
+  //we never report warnings, the diagnostics engine is already set up from the command line by the time
+  //ConfigureCompiler runs so it has to be passed here to skip the work for them
+  if(settings.DeclarationsOnly){
+    commandLine.push_back("-w");
+  }
+
+  return commandLine;
+}
+
+//Runs ParseLJ over one source file at a time. Each worker thread owns its own SourceParser so the
+//FileManager and its stat cache is shared by all the source files that worker parses
+class SourceParser{
 
 public:
-  LJFrontendActionFactory(bool verboseOutput) : 
-    VerboseOutput(verboseOutput){
+  SourceParser(const CompilationDatabase& compilations, ResultCache* cache, const ParseSettings& settings) : 
+    Compilations(compilations), Cache(cache), Settings(settings), Files(new clang::FileManager(clang::FileSystemOptions(), settings.FileSystem)){
   }
 
-  virtual clang::FrontendAction *create() { 
-    return new ParseLJ(VerboseOutput); 
+  bool ParseSource(const std::string& sourcePath, RecorderCollection* recorders){
+
+    const PrefixHeader* prefix = (Settings.Prefix && Settings.Prefix->CanUseFor(sourcePath)) ? Settings.Prefix : NULL;
+    bool success = true;
+
+    //FixedCompilationDatabase commands all run from the current directory so unlike ClangTool we never
+    //need to chdir which would not be safe to do from multiple threads
+    for(auto& command : Compilations.getCompileCommands(getAbsolutePath(sourcePath))){
+      std::vector<std::string> commandLine = GetParseCommandLine(command, Settings);
+
+      bool cached;
+      {
+        TimeTraceScope timer(Cache ? Settings.Trace : NULL, "Cache load", sourcePath);
+        cached = Cache != NULL && Cache->Load(sourcePath, commandLine, *recorders);
+      }
+
+      if(cached){
+        if(Settings.Verbose){
+          std::cout << "Using cached records for " << sourcePath << "\n";
+        }
+        continue;
+      }
+
+      //the headers in the PCH are never seen by the preprocessor so replay what was recorded from them
+      if(prefix != NULL){
+        prefix->ReplayRecords(*recorders);
+      }
+
+      std::vector<std::string> cacheKey = commandLine;
+      ToolInvocation invocation(std::move(commandLine), new ParseLJ(recorders, Settings, prefix), Files.get());
+
+      bool parsed = invocation.run();
+
+      //only cache files that parsed cleanly so errors are always reported again on the next run
+      if(Cache != NULL && parsed && RecordsValid(*recorders)){
+        Cache->Store(sourcePath, cacheKey, *recorders);
+      }
+
+      success = parsed && success;
+    }
+
+    return success;
   }
 
 private:
-  bool VerboseOutput;
+  static bool RecordsValid(const RecorderCollection& recorders){
+
+    for(RecordEntry* entry : recorders.AllFunctions){
+      if(!entry->Valid){
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  const CompilationDatabase& Compilations;
+  ResultCache* Cache;
+  const ParseSettings& Settings;
+  llvm::IntrusiveRefCntPtr<clang::FileManager> Files;
 };
 
+//Parses every source file into its own RecorderCollection shard using jobCount worker threads, the shards 
+//are then merged in the order the sources were given so the output is the same as a serial run
+void ParseSources(const CompilationDatabase& compilations, const std::vector<std::string>& sources, RecorderCollection* recorders,
+                  ResultCache* cache, unsigned jobCount, const ParseSettings& settings){
+
+  std::vector<unique_ptr<RecorderCollection>> shards(sources.size());
+  std::atomic<size_t> nextSource(0);
+
+  auto worker = [&](){
+    SourceParser parser(compilations, cache, settings);
+
+    for(size_t i = nextSource++; i < sources.size(); i = nextSource++){
+      TimeTraceScope timer(settings.Trace, "Source", sources[i]);
+
+      shards[i].reset(new RecorderCollection(settings.Verbose));
+      parser.ParseSource(sources[i], shards[i].get());
+    }
+  };
+
+  if(jobCount == 0){
+    jobCount = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  jobCount = std::min<size_t>(jobCount, sources.size());
+
+  if(jobCount <= 1){
+    worker();
+  }else{
+    std::vector<std::thread> workers;
+
+    for(unsigned i = 0; i != jobCount ;i++){
+      workers.emplace_back(worker);
+    }
+
+    for(auto& thread : workers){
+      thread.join();
+    }
+  }
+
+  TimeTraceScope timer(settings.Trace, "Merge shards");
+
+  for(auto& shard : shards){
+    recorders->MergeShard(*shard);
+  }
+}
+
+//Build the PCH for the prefix header unless the one saved in the cache is still valid, its built with the command
+//line of the first source file using it
+static bool BuildPrefixHeader(const CompilationDatabase& compilations, const std::vector<std::string>& sources, PrefixHeader& prefix,
+                              ResultCache* cache, const ParseSettings& settings, const std::string& outputDir){
+
+  auto firstUser = std::find_if(sources.begin(), sources.end(), [&](const std::string& source){
+    return prefix.CanUseFor(source);
+  });
+
+  if(firstUser == sources.end()){
+    return false;
+  }
+
+  std::vector<CompileCommand> commands = compilations.getCompileCommands(getAbsolutePath(*firstUser));
+
+  if(commands.empty()){
+    return false;
+  }
+
+  std::vector<std::string> commandLine = GetParseCommandLine(commands.front(), settings);
+
+  if(prefix.Prepare(outputDir, commandLine, cache)){
+    if(settings.Verbose){
+      std::cout << "Using saved precompiled prefix header " << prefix.GetPCHPath() << "\n";
+    }
+    return true;
+  }
+
+  TimeTraceScope timer(settings.Trace, "Build PCH", prefix.GetPCHPath());
+  RecorderCollection records(settings.Verbose);
+  llvm::IntrusiveRefCntPtr<clang::FileManager> files(new clang::FileManager(clang::FileSystemOptions(), settings.FileSystem));
+
+  ToolInvocation invocation(prefix.GetBuildCommandLine(commandLine), new BuildPrefixLJ(prefix, &records, settings), files.get());
+
+  if(!invocation.run()){
+    return false;
+  }
+
+  prefix.Save();
+
+  if(settings.Verbose){
+    std::cout << "Built precompiled prefix header " << prefix.GetPCHPath() << " from " << prefix.GetLines().size() << " lines\n";
+  }
+
+  return true;
+}
+
+static std::string EscapeDependencyPath(StringRef path){
+
+  std::string escaped;
+
+  for(char c : path){
+    if(c == ' ' || c == '#'){
+      escaped += '\\';
+    }else if(c == '$'){
+      escaped += '$';
+    }
+
+    escaped += c;
+  }
+
+  return escaped;
+}
+
+//Write a Make style depfile that Ninja can also read listing every source and header the records came from
+static bool WriteDependencyFile(const std::string& depFile, const std::string& target, const std::vector<std::string>& dependencies){
+
+  std::ofstream output(depFile, std::ios::binary);
+
+  if(!output){
+    return false;
+  }
+
+  output << EscapeDependencyPath(target) << ":";
+
+  for(auto& path : dependencies){
+    output << " \\\n  " << EscapeDependencyPath(path);
+  }
+
+  output << "\n";
+
+  return output.good();
+}
+
 cl::list<std::string> SourcePaths(
   cl::Positional,
   cl::desc("<source0> [... <sourceN>]"),
-  cl::OneOrMore);
+  cl::ZeroOrMore);
 
 cl::list<std::string> IncludeList(
   "includes",
@@ -133,47 +556,441 @@ cl::list<std::string> IncludeList(
 cl::opt<std::string> OutputFile(
   "o",
   cl::desc("<output-file-path>"),
-  cl::Required);
+  cl::Optional);
+
+cl::opt<bool> WriteDepFile(
+  "MD",
+  cl::desc("<write a depfile listing every source and header the output depends on to <output-file-path>.d>"),
+  cl::Optional);
+
+cl::opt<std::string> DepFile(
+  "MF",
+  cl::desc("<path to write the depfile to, implies -MD>"),
+  cl::Optional);
 
 cl::opt<bool> VerboseOutput(
   "verbose",
   cl::desc("<print verbose info about parsing>"),
   cl::Optional);
 
+cl::opt<unsigned> JobCount(
+  "j",
+  cl::desc("<number of source files to parse in parallel, 0 uses one per hardware thread>"),
+  cl::Prefix,
+  cl::init(1));
+
+cl::opt<bool> DeclarationsOnly(
+  "decls-only",
+  cl::desc("<skip parsing function bodies since only function declarations are needed to bind recorders>"),
+  cl::Optional);
+
+cl::opt<bool> UseMatchFinder(
+  "generic-matcher",
+  cl::desc("<find functions with the generic AST matcher instead of the specialized signature visitor>"),
+  cl::Optional);
+
+cl::opt<std::string> CacheDir(
+  "cache-dir",
+  cl::desc("<directory to cache the records of each source file in so unchanged files are not parsed again>"),
+  cl::Optional);
+
+cl::opt<bool> UsePrefixHeader(
+  "pch",
+  cl::desc("<precompile the #include and #define lines the source files start with and share it between them>"),
+  cl::Optional);
+
+cl::list<std::string> PrefixIncludes(
+  "pch-includes",
+  cl::CommaSeparated,
+  cl::desc("<list of headers to precompile, only source files that start by including them use the PCH>"),
+  cl::ZeroOrMore);
+
+cl::opt<std::string> ToolChainCache(
+  "toolchain-cache",
+  cl::desc("<file to save the probed system include directories and target triple in, defaults to toolchain.txt in the cache directory>"),
+  cl::Optional);
+
+cl::opt<std::string> WindowsSDKVersion(
+  "windows-sdk",
+  cl::desc("<version of the Windows SDK to use the headers of>"),
+  cl::init("v7.0A"));
+
+cl::opt<std::string> VisualStudioVersion(
+  "vs-version",
+  cl::desc("<version of Visual Studio to use the headers of>"),
+  cl::init("8.0"));
+
+cl::opt<bool> RegistrationTables(
+  "reg-tables",
+  cl::desc("<emit the lib registration as constant descriptor tables registered by one loop instead of Lua API calls for every function>"),
+  cl::Optional);
+
+cl::opt<bool> RegistrationStream(
+  "reg-stream",
+  cl::desc("<emit the lib registration as a compact byte stream per object that a small fixed loader registers>"),
+  cl::Optional);
+
+cl::opt<bool> SplitOutput(
+  "split-output",
+  cl::desc("<write each object's registration to its own file next to the output file which only keeps Register_LuaLib>"),
+  cl::Optional);
+
+cl::opt<bool> LazyRegistration(
+  "lazy-reg",
+  cl::desc("<only register an object's functions the first time a script uses its table or the VM looks up its metatable>"),
+  cl::Optional);
+
+cl::opt<bool> DenseRecorderTable(
+  "recorder-table",
+  cl::desc("<also emit FunctionId indexed fast function and recorder tables with a function address to FunctionId hash>"),
+  cl::Optional);
+
+cl::opt<bool> PrehashKeys(
+  "prehash-keys",
+  cl::desc("<with -reg-tables intern the member and metatable keys in one batch and order them by their LuaJIT string hash>"),
+  cl::Optional);
+
+cl::opt<bool> UseSharedFiles(
+  "shared-vfs",
+  cl::desc("<read each source and header from disk once and share it in memory between every source file and worker>"),
+  cl::Optional);
+
+cl::opt<bool> EnableTimeTrace(
+  "time-trace",
+  cl::desc("<write a Chrome trace of where the time of the run went and print a summary of it>"),
+  cl::Optional);
+
+cl::opt<std::string> TimeTraceFile(
+  "time-trace-file",
+  cl::desc("<path to write the time trace to, defaults to <output-file-path>.trace.json>"),
+  cl::Optional);
+
+cl::opt<bool> RunAsServer(
+  "server",
+  cl::desc("<stay running and regenerate outputs for clients connecting to the socket>"),
+  cl::Optional);
+
+cl::opt<bool> RunAsClient(
+  "client",
+  cl::desc("<send the request to a running server, runs locally if there is none>"),
+  cl::Optional);
+
+cl::opt<std::string> SocketPath(
+  "socket",
+  cl::desc("<path of the Unix socket the server listens on>"),
+  cl::Optional);
+
+cl::opt<bool> WatchInputs(
+  "watch",
+  cl::desc("<with -server, regenerate the last output as soon as one of its inputs changes>"),
+  cl::Optional);
 
 
-int main(int argc, const char **argv, char * const *envp){
 
-  unique_ptr<FixedCompilationDatabase> Compilations;
-  Compilations.reset(FixedCompilationDatabase::loadFromCommandLine(argc, argv));
-  cl::ParseCommandLineOptions(argc, argv);
+//State kept between runs, a server keeps it for its whole lifetime so the toolchain is only resolved once and
+//the cached records and PCH stay warm in memory
+struct GeneratorState{
+  ParseSettings Settings;
+  std::string CacheDir;
+  unique_ptr<ResultCache> Cache;
+  unique_ptr<TimeTrace> Trace;
+};
 
-  if(!Compilations){
-    std::string ErrorMessage;
-   // Compilations = CompilationDatabase::autoDetectFromSource(SourcePaths[0], ErrorMessage);
-    
-    if(!Compilations)llvm::report_fatal_error(ErrorMessage);
+//The emitter options come from the client when running as a server so they're checked for each request
+static bool CheckEmitterOptions(const GenerateRequest& request){
+
+  if(request.SplitOutput && (request.RegistrationTables || request.RegistrationStream)){
+    std::cout << "-split-output can't be combined with -reg-tables or -reg-stream\n";
+    return false;
   }
 
-  InitializeAllTargetInfos();
-  InitializeAllTargetMCs();
-  InitializeAllAsmParsers();
+  //only the table emitter has key tables to hash up front
+  if(request.PrehashKeys && (!request.RegistrationTables || request.RegistrationStream)){
+    std::cout << "-prehash-keys requires -reg-tables and can't be combined with -reg-stream\n";
+    return false;
+  }
 
-  ClangTool Tool(*Compilations, SourcePaths);
+  return true;
+}
 
-  LJMacros = new RecorderCollection(VerboseOutput);
+static int GenerateOutput(const GenerateRequest& request, GeneratorState& state, std::vector<std::string>& inputs){
 
-  Tool.run(new LJFrontendActionFactory(VerboseOutput));
+  if(!CheckEmitterOptions(request)){
+    return 1;
+  }
 
-  LibRegBuilder regBuilder(LJMacros, OutputFile);
+  FixedCompilationDatabase compilations(".", request.CompilerArgs);
+  const std::vector<std::string>& sources = request.Sources;
 
-  if(!regBuilder.RecordersValid()){
-    return 1;
+  unique_ptr<RecorderCollection> LJMacros(new RecorderCollection(request.Verbose));
+  ResultCache* cache = state.Cache.get();
+  ParseSettings settings = state.Settings;
+  settings.DeclarationsOnly = request.DeclarationsOnly;
+  settings.Verbose = request.Verbose;
+
+  if(cache != NULL){
+    cache->NewRun();
   }
 
-  regBuilder.WriteLibReg(IncludeList);
+  llvm::IntrusiveRefCntPtr<SharedFileOverlay> sharedFiles;
+
+  if(request.UseSharedFiles){
+    sharedFiles = new SharedFileOverlay();
+    sharedFiles->Preload(sources);
+    settings.FileSystem = sharedFiles.get();
+  }
+
+  PrefixHeader prefix;
+  llvm::SmallString<128> prefixDir(state.CacheDir);
+  bool hasPrefix = false;
+
+  if(request.UsePrefixHeader || !request.PrefixIncludes.empty()){
+    hasPrefix = request.PrefixIncludes.empty() ? prefix.DetectPrefix(sources) : prefix.SetPrefixIncludes(request.PrefixIncludes, sources);
+
+    //without a cache directory the PCH only lives for this run
+    if(hasPrefix && state.CacheDir.empty() && llvm::sys::fs::createUniqueDirectory("buildvm_clang-pch", prefixDir)){
+      hasPrefix = false;
+    }
+
+    if(hasPrefix && BuildPrefixHeader(compilations, sources, prefix, cache, settings, prefixDir.str())){
+      settings.Prefix = &prefix;
+    }else if(request.Verbose){
+      std::cout << "Not using a precompiled prefix header\n";
+    }
+  }
+
+  {
+    TimeTraceScope timer(settings.Trace, "Parse sources");
+    ParseSources(compilations, sources, LJMacros.get(), cache, request.JobCount, settings);
+  }
+
+  if(hasPrefix && state.CacheDir.empty()){
+    prefix.RemoveFiles();
+    llvm::sys::fs::remove(prefixDir);
+  }
+
+  if(request.Verbose){
+    std::cout << "Record arena: " << LJMacros->GetArena().GetBytesAllocated() << " bytes\n";
+  }
+
+  if(cache && request.Verbose){
+    std::cout << "Result cache: " << cache->GetHitCount() << " hits, " << cache->GetMissCount() << " misses\n";
+  }
+
+  if(sharedFiles && request.Verbose){
+    std::cout << "Shared files: " << sharedFiles->GetFileCount() << " files with " << sharedFiles->GetUniqueContentCount() 
+              << " unique contents, " << sharedFiles->GetBytesReadFromDisk() << " bytes read from disk, " 
+              << sharedFiles->GetBytesServed() << " bytes served from memory\n";
+  }
+
+  inputs = LJMacros->IncludedFiles;
+
+  {
+    TimeTraceScope timer(settings.Trace, "Write output", request.OutputFile);
+    RecorderTable table(*LJMacros);
+    LibRegBuilder regBuilder(table, request.OutputFile);
+
+    if(!regBuilder.RecordersValid()){
+      return 1;
+    }
+
+    if(request.Verbose){
+      std::cout << "Fast functions: " << table.GetFunctionCount() << " in " << table.GetObjectCount() << " objects\n";
+    }
+
+    regBuilder.SetLazyObjects(request.LazyObjects);
+    regBuilder.SetDenseRecorders(request.DenseRecorders);
+    regBuilder.SetPrehashKeys(request.PrehashKeys);
+
+    if(request.SplitOutput){
+      regBuilder.WriteLibRegSplit(request.Includes);
+    }else if(request.RegistrationStream){
+      regBuilder.WriteLibRegStream(request.Includes);
+    }else if(request.RegistrationTables){
+      regBuilder.WriteLibRegTables(request.Includes);
+
+      if(request.PrehashKeys && request.Verbose){
+        std::cout << "Registration keys sharing a main node: " << regBuilder.GetKeyCollisions() << "\n";
+      }
+    }else{
+      regBuilder.WriteLibReg(request.Includes);
+    }
+
+    WriteResult result = regBuilder.SaveOutput();
+
+    if(result == Write_Failed){
+      std::cout << "Failed to write output file " << request.OutputFile << "\n";
+      return 1;
+    }
+
+    //always printed so a build log shows whether dependents of the output will rebuild
+    std::cout << "Output " << request.OutputFile << (result == Write_Unchanged ? " unchanged, kept the existing file\n" : " updated\n");
+  }
+
+  if(!request.DepFile.empty() && !WriteDependencyFile(request.DepFile, request.OutputFile, LJMacros->IncludedFiles)){
+    std::cout << "Failed to write depfile " << request.DepFile << "\n";
+    return 1;
+  }
 
   std::cout.flush();
 
   return 0;
-}
\ No newline at end of file
+}
+
+static int RunGenerator(const GenerateRequest& request, GeneratorState& state, std::vector<std::string>& inputs){
+
+  int exitCode = GenerateOutput(request, state, inputs);
+
+  if(state.Trace){
+    std::string traceFile = TimeTraceFile.empty() ? request.OutputFile + ".trace.json" : TimeTraceFile;
+
+    if(!state.Trace->WriteChromeTrace(traceFile)){
+      std::cout << "Failed to write time trace " << traceFile << "\n";
+    }
+
+    state.Trace->PrintSummary(std::cout);
+
+    //a server starts a new trace for each request
+    state.Trace.reset(new TimeTrace());
+    state.Settings.Trace = state.Trace.get();
+  }
+
+  return exitCode;
+}
+
+int main(int argc, const char **argv, char * const *envp){
+
+  GenerateRequest request;
+
+  for(int i = 1; i < argc ;i++){
+    if(strcmp(argv[i], "--") == 0){
+      request.CompilerArgs.assign(argv+i+1, argv+argc);
+      break;
+    }
+  }
+
+  unique_ptr<FixedCompilationDatabase> Compilations;
+  Compilations.reset(FixedCompilationDatabase::loadFromCommandLine(argc, argv));
+  cl::ParseCommandLineOptions(argc, argv);
+
+  if(!RunAsServer){
+    if(OutputFile.empty() || SourcePaths.empty()){
+      std::cout << "An output file and at least one source file are required\n";
+      return 1;
+    }
+
+    if(!Compilations){
+      std::string ErrorMessage;
+     // Compilations = CompilationDatabase::autoDetectFromSource(SourcePaths[0], ErrorMessage);
+      
+      if(!Compilations)llvm::report_fatal_error(ErrorMessage);
+    }
+  }
+
+  llvm::SmallString<128> workingDir;
+  llvm::sys::fs::current_path(workingDir);
+
+  request.WorkingDir = workingDir.str();
+  request.OutputFile = OutputFile;
+  request.Sources = SourcePaths;
+  request.Includes = IncludeList;
+  request.JobCount = JobCount;
+  request.UsePrefixHeader = UsePrefixHeader;
+  request.DeclarationsOnly = DeclarationsOnly;
+  request.PrefixIncludes = PrefixIncludes;
+  request.Verbose = VerboseOutput;
+  request.UseSharedFiles = UseSharedFiles;
+  request.RegistrationTables = RegistrationTables;
+  request.RegistrationStream = RegistrationStream;
+  request.SplitOutput = SplitOutput;
+  request.LazyObjects = LazyRegistration;
+  request.DenseRecorders = DenseRecorderTable;
+  request.PrehashKeys = PrehashKeys;
+
+  //fail before a server or the toolchain is involved, the server checks the request again itself
+  if(!RunAsServer && !CheckEmitterOptions(request)){
+    return 1;
+  }
+
+  if(WriteDepFile || !DepFile.empty()){
+    request.DepFile = DepFile.empty() ? OutputFile + ".d" : DepFile;
+  }
+
+  std::string socketPath = SocketPath.empty() ? GetDefaultSocketPath() : SocketPath;
+
+  if(RunAsClient){
+    int exitCode = RunClient(socketPath, request);
+
+    if(exitCode >= 0){
+      return exitCode;
+    }
+
+    //still generate the output when the server isn't running so a build never depends on it
+    if(VerboseOutput){
+      std::cout << "No server listening on " << socketPath << ", running locally\n";
+    }
+  }
+
+  GeneratorState state;
+  state.CacheDir = CacheDir;
+
+  //a server always keeps a cache so the PCH and records of unchanged files carry over between requests
+  if(RunAsServer && state.CacheDir.empty()){
+    llvm::SmallString<128> serverCacheDir;
+
+    if(!llvm::sys::fs::createUniqueDirectory("buildvm_clang-server", serverCacheDir)){
+      state.CacheDir = serverCacheDir.str();
+    }
+  }
+
+  std::string toolChainCache = ToolChainCache;
+
+  if(toolChainCache.empty() && !state.CacheDir.empty()){
+    llvm::SmallString<128> cachePath(state.CacheDir);
+    llvm::sys::path::append(cachePath, "toolchain.txt");
+    toolChainCache = cachePath.str();
+  }
+
+  if(!state.CacheDir.empty()){
+    llvm::sys::fs::create_directories(state.CacheDir);
+    state.Cache.reset(new ResultCache(state.CacheDir, RunAsServer));
+  }
+
+  if(EnableTimeTrace){
+    state.Trace.reset(new TimeTrace());
+    state.Settings.Trace = state.Trace.get();
+  }
+
+  ToolChainInfo toolChain;
+  {
+    TimeTraceScope timer(state.Trace.get(), "Toolchain setup");
+    if(!ResolveToolChain(toolChain, toolChainCache, WindowsSDKVersion, VisualStudioVersion, VerboseOutput)){
+      bool noSystemIncludes = std::find(request.CompilerArgs.begin(), request.CompilerArgs.end(), "-nostdinc") != request.CompilerArgs.end();
+
+      //sources built with -nostdinc never need them, a server can't know what its clients will pass so it carries on
+      //and any source that includes a system header fails to parse instead
+      if(!noSystemIncludes && !RunAsServer){
+        std::cerr << "Error failed to find the system include directories of the host toolchain\n";
+        return 1;
+      }
+
+      std::cerr << "Warning failed to find the system include directories of the host toolchain\n";
+    }
+
+    InitializeToolChainTargets(toolChain);
+  }
+
+  state.Settings.Verbose = VerboseOutput;
+  state.Settings.UseMatchFinder = UseMatchFinder;
+  state.Settings.ToolChain = &toolChain;
+
+  if(RunAsServer){
+    return RunServer(socketPath, WatchInputs, VerboseOutput, [&](const GenerateRequest& serverRequest, std::vector<std::string>& inputs){
+      return RunGenerator(serverRequest, state, inputs);
+    });
+  }
+
+  std::vector<std::string> inputs;
+
+  return RunGenerator(request, state, inputs);
+}
@@ -0,0 +1,428 @@
+#include "Benchmarks.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  //use the kernel32 version so there is no extra library to link
+  #define PSAPI_VERSION 2
+  #include <psapi.h>
+#else
+  #include <fcntl.h>
+  #include <sys/resource.h>
+  #include <sys/time.h>
+  #include <sys/wait.h>
+  #include <unistd.h>
+#endif
+
+using llvm::StringRef;
+using std::string;
+
+static const unsigned ModuleFieldCount = 16;
+
+//Every file the corpus generator wrote so they can be removed again without recursively deleting a directory
+class CorpusFiles{
+
+public:
+  ~CorpusFiles(){
+    for(auto& path : Files){
+      llvm::sys::fs::remove(path);
+    }
+
+    //remove the deepest directories first
+    for(auto it = Dirs.rbegin(); it != Dirs.rend() ;it++){
+      llvm::sys::fs::remove(*it);
+    }
+  }
+
+  void AddDir(const string& path){
+    llvm::sys::fs::create_directories(path);
+    Dirs.push_back(path);
+  }
+
+  bool Write(const string& path, const string& contents){
+
+    std::ofstream output(path, std::ios::binary);
+    output << contents;
+    Files.push_back(path);
+
+    return output.good();
+  }
+
+  void Add(const string& path){
+    Files.push_back(path);
+  }
+
+private:
+  std::vector<string> Files, Dirs;
+};
+
+static string JoinPath(StringRef dir, StringRef name){
+  llvm::SmallString<256> path(dir);
+  llvm::sys::path::append(path, name);
+  return path.str();
+}
+
+//Headers shaped like the LuaJIT ones every lib file includes, each one also includes the one before it so the
+//include graph has the same nesting the real headers have
+static string GenerateSharedHeader(unsigned index){
+
+  std::ostringstream header;
+  header << "#pragma once\n";
+  header << (index == 0 ? "#include \"lj_ff.h\"\n\n" : "#include \"lj_shared" + std::to_string(index-1) + ".h\"\n\n");
+
+  for(unsigned i = 0; i != 40 ;i++){
+    header << "typedef struct Shared" << index << "_" << i << "{\n  int count;\n  float scale;\n  void* data;\n  struct Shared"
+           << index << "_" << i << "* next;\n} Shared" << index << "_" << i << ";\n\n";
+    header << "inline int shared" << index << "_helper" << i << "(Shared" << index << "_" << i << "* value){\n"
+           << "  return value->next ? value->count*" << (i+1) << " : " << index << ";\n}\n\n";
+  }
+
+  return header.str();
+}
+
+static string GenerateModuleHeader(unsigned module){
+
+  std::ostringstream header;
+  header << "#pragma once\n\nstruct Mod" << module << "{\n";
+
+  for(unsigned i = 0; i != ModuleFieldCount ;i++){
+    header << "  int field" << i << ";\n";
+  }
+
+  header << "};\n";
+
+  return header.str();
+}
+
+//A lib file with functionCount fast functions, a mix of plain recorders, upvalues, field getters and
+//metamethods. Every third module is a cdata module the rest are userdata
+static string GenerateLibSource(unsigned module, unsigned moduleCount, unsigned functionCount, unsigned sharedHeaders){
+
+  std::ostringstream source;
+  source << "#include \"lj_ff.h\"\n";
+
+  for(unsigned i = 0; i != sharedHeaders ;i++){
+    source << "#include \"lj_shared" << i << ".h\"\n";
+  }
+
+  source << "#include \"mod" << module << ".h\"\n";
+  source << "#include \"mod" << ((module+1) % moduleCount) << ".h\"\n\n";
+
+  string name = "Mod" + std::to_string(module);
+
+  source << "LJFF_MODULE(" << name << ", " << ((module % 3) == 2 ? "cdata" : "userdata") << ")\n";
+  source << "LJFF_ALIAS(" << name << "_self, base+1)\n\n";
+
+  for(unsigned i = 0; i != functionCount ;i++){
+    switch(i % 4){
+      case 0:
+        source << "LJFF_REC(.) int " << name << "_func" << i << "(lua_State* L){\n";
+        break;
+      case 1:
+        source << "LJFF_PUSH(MemberList) LJFF_REC(.) int " << name << "_func" << i << "(lua_State* L){\n";
+        break;
+      case 2:
+        source << "LJFF_REC_GETFIELD(field" << (i % ModuleFieldCount) << ") int " << name << "_get" << i << "(lua_State* L){\n";
+        break;
+      case 3:
+        source << "LJFF_PUSH(\"meta" << i << "\") LJFF_REC(.) int " << name << "___meta" << i << "(lua_State* L){\n";
+        break;
+    }
+
+    if(sharedHeaders != 0){
+      source << "  Shared0_" << (i % 40) << " value = {" << i << ", 1.0f, L, 0};\n";
+      source << "  return shared0_helper" << (i % 40) << "(&value);\n}\n\n";
+    }else{
+      source << "  return L != 0;\n}\n\n";
+    }
+  }
+
+  return source.str();
+}
+
+static bool GenerateCorpus(CorpusFiles& files, const string& dir, unsigned fileCount, unsigned functionsPerFile, unsigned sharedHeaders,
+                           std::vector<string>& sources){
+
+  string includeDir = JoinPath(dir, "include");
+  string sourceDir = JoinPath(dir, "src");
+
+  files.AddDir(includeDir);
+  files.AddDir(sourceDir);
+
+  std::ostringstream ffHeader;
+  ffHeader << "#pragma once\n\nstruct lua_State;\n\n";
+
+  for(const char* directive : {"ALIAS", "MODULE", "NEEDSFLAG", "NOEXTERN", "PUSH", "REC", "REC_GETFIELD", "REC_SETFIELD"}){
+    ffHeader << "#define LJFF_" << directive << "(...)\n";
+  }
+
+  bool success = files.Write(JoinPath(includeDir, "lj_ff.h"), ffHeader.str());
+
+  for(unsigned i = 0; i != sharedHeaders ;i++){
+    success = files.Write(JoinPath(includeDir, "lj_shared" + std::to_string(i) + ".h"), GenerateSharedHeader(i)) && success;
+  }
+
+  for(unsigned i = 0; i != fileCount ;i++){
+    string sourcePath = JoinPath(sourceDir, "lib_mod" + std::to_string(i) + ".cpp");
+
+    success = files.Write(JoinPath(includeDir, "mod" + std::to_string(i) + ".h"), GenerateModuleHeader(i)) && success;
+    success = files.Write(sourcePath, GenerateLibSource(i, fileCount, functionsPerFile, sharedHeaders)) && success;
+    sources.push_back(sourcePath);
+  }
+
+  return success;
+}
+
+//Run a process with its output sent to logPath, returns its exit code or -1 if it could not be started.
+//peakRSS is set to the most memory the process had resident at once
+static int RunProcess(const std::vector<string>& args, const string& logPath, uint64_t& peakRSS){
+
+  peakRSS = 0;
+
+#if defined(_WIN32)
+  string commandLine;
+
+  for(auto& arg : args){
+    commandLine += (commandLine.empty() ? "\"" : " \"") + arg + "\"";
+  }
+
+  SECURITY_ATTRIBUTES inheritable = {sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+  HANDLE log = CreateFileA(logPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &inheritable, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if(log == INVALID_HANDLE_VALUE){
+    return -1;
+  }
+
+  STARTUPINFOA startup = {sizeof(STARTUPINFOA)};
+  startup.dwFlags = STARTF_USESTDHANDLES;
+  startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+  startup.hStdOutput = log;
+  startup.hStdError = log;
+
+  PROCESS_INFORMATION process;
+
+  if(!CreateProcessA(NULL, &commandLine[0], NULL, NULL, TRUE, 0, NULL, NULL, &startup, &process)){
+    CloseHandle(log);
+    return -1;
+  }
+
+  WaitForSingleObject(process.hProcess, INFINITE);
+
+  DWORD exitCode = 1;
+  GetExitCodeProcess(process.hProcess, &exitCode);
+
+  PROCESS_MEMORY_COUNTERS memory;
+
+  if(GetProcessMemoryInfo(process.hProcess, &memory, sizeof(memory))){
+    peakRSS = memory.PeakWorkingSetSize;
+  }
+
+  CloseHandle(process.hThread);
+  CloseHandle(process.hProcess);
+  CloseHandle(log);
+
+  return (int)exitCode;
+#else
+  std::vector<char*> argv;
+
+  for(auto& arg : args){
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+
+  argv.push_back(NULL);
+
+  pid_t pid = fork();
+
+  if(pid == -1){
+    return -1;
+  }
+
+  if(pid == 0){
+    int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(log != -1){
+      dup2(log, STDOUT_FILENO);
+      dup2(log, STDERR_FILENO);
+    }
+
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+
+  int status;
+  rusage usage;
+
+  if(wait4(pid, &status, 0, &usage) == -1){
+    return -1;
+  }
+
+#if defined(__APPLE__)
+  peakRSS = usage.ru_maxrss;
+#else
+  //Linux reports it in kilobytes
+  peakRSS = (uint64_t)usage.ru_maxrss*1024;
+#endif
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+static string ReadFile(const string& path){
+
+  std::ifstream input(path, std::ios::binary);
+  std::ostringstream contents;
+  contents << input.rdbuf();
+
+  return contents.str();
+}
+
+//The number of fast functions the generator found from the summary -verbose prints. The registration emitters
+//all write different code for a function so counting in the output file would depend on the generator args
+static size_t ReadFunctionCount(const string& logPath){
+
+  string log = ReadFile(logPath);
+  StringRef summary = "Fast functions: ";
+  size_t pos = StringRef(log).find(summary);
+  size_t count = 0;
+
+  if(pos == StringRef::npos){
+    return 0;
+  }
+
+  StringRef number = StringRef(log).substr(pos+summary.size());
+  number = number.substr(0, number.find_first_not_of("0123456789"));
+
+  return number.getAsInteger(10, count) ? 0 : count;
+}
+
+//Generate a corpus of the given size and time the generator over it, costs are relative to the first
+//size of a sweep which sets baseCost. A relative cost that stays near 1 as the corpus doubles is linear scaling
+bool BenchmarkRunner::RunCorpus(const CorpusOptions& options, const string& corpusDir, StringRef group, unsigned fileCount,
+                                unsigned functionsPerFile, double& baseCost){
+
+  string runDir = JoinPath(corpusDir, group.str().substr(group.find('/')+1) + "_" + std::to_string(fileCount) + "x" + std::to_string(functionsPerFile));
+  string outputPath = JoinPath(runDir, "lj_libreg.cpp");
+  string logPath = JoinPath(runDir, "generator.log");
+  std::vector<string> sources;
+
+  CorpusFiles files;
+  files.AddDir(runDir);
+  files.Add(outputPath);
+  files.Add(logPath);
+
+  if(!GenerateCorpus(files, runDir, fileCount, functionsPerFile, options.SharedHeaders, sources)){
+    ReportFailure(group, "failed to write the corpus to " + runDir);
+    return false;
+  }
+
+  std::vector<string> args = {options.Generator, "-o", outputPath, "-j" + std::to_string(options.JobCount),
+                              "-toolchain-cache=" + JoinPath(corpusDir, "toolchain.txt")};
+  args.insert(args.end(), options.GeneratorArgs.begin(), options.GeneratorArgs.end());
+  args.insert(args.end(), sources.begin(), sources.end());
+  args.insert(args.end(), {"--", "-I" + JoinPath(runDir, "include"), "-std=c++11", "-w"});
+
+  //only the warm-up run prints the summary the number of annotations is checked against
+  std::vector<string> warmupArgs = args;
+  warmupArgs.insert(warmupArgs.begin()+1, "-verbose");
+
+  uint64_t annotations = (uint64_t)fileCount*functionsPerFile;
+  uint64_t maxPeakRSS = 0;
+  std::vector<uint64_t> times;
+
+  //the first run is not timed, it probes the toolchain and gets the corpus into the OS file cache
+  for(unsigned i = 0; i != RepeatCount+1 ;i++){
+    uint64_t peakRSS;
+    auto start = std::chrono::steady_clock::now();
+    int exitCode = RunProcess(i == 0 ? warmupArgs : args, logPath, peakRSS);
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+
+    if(exitCode != 0){
+      //the corpus is removed when we return so show what the generator printed now
+      ReportFailure(group, "generator exited with " + std::to_string(exitCode) + ":\n" + ReadFile(logPath));
+      return false;
+    }
+
+    if(i == 0){
+      size_t found = ReadFunctionCount(logPath);
+
+      if(found != annotations){
+        ReportFailure(group, "the generator found " + std::to_string(found) + " of " + std::to_string(annotations) + " annotated functions");
+        return false;
+      }
+      continue;
+    }
+
+    times.push_back(time);
+    maxPeakRSS = std::max(maxPeakRSS, peakRSS);
+  }
+
+  std::vector<uint64_t> sorted = times;
+  std::sort(sorted.begin(), sorted.end());
+  double seconds = sorted[sorted.size()/2]/1e9;
+  double cost = seconds/annotations;
+
+  if(baseCost == 0){
+    baseCost = cost;
+  }
+
+  AddResult(group, {{"files", fileCount}, {"functions", functionsPerFile}}, annotations, times, 0,
+            {{"files_per_sec", fileCount/seconds}, {"annotations_per_sec", annotations/seconds},
+             {"peak_rss_mb", maxPeakRSS/(1024.0*1024.0)}, {"relative_cost", cost/baseCost}});
+
+  return true;
+}
+
+//Two sweeps each doubling the corpus size every step, one doubles the number of lib files and the other the
+//number of fast functions in each file
+void BenchmarkRunner::RunCorpusBenchmarks(const CorpusOptions& options){
+
+  //checked first so a temporary corpus directory isn't left behind
+  if(!llvm::sys::fs::can_execute(options.Generator)){
+    ReportFailure("corpus", "generator " + options.Generator + " is not an executable, set it with -generator");
+    return;
+  }
+
+  llvm::SmallString<128> corpusDir(options.CorpusDir);
+  bool tempDir = corpusDir.empty();
+
+  if(tempDir && llvm::sys::fs::createUniqueDirectory("buildvm_clang-corpus", corpusDir)){
+    ReportFailure("corpus", "failed to create a temporary directory for the corpus");
+    return;
+  }
+
+  llvm::sys::fs::create_directories(corpusDir);
+
+  for(int sweep = 0; sweep != 2 ;sweep++){
+    StringRef group = sweep == 0 ? "corpus/files" : "corpus/functions";
+    double baseCost = 0;
+
+    if(!IsEnabled(group)){
+      continue;
+    }
+
+    for(unsigned step = 0; step != std::max(options.Steps, 1u) ;step++){
+      unsigned fileCount = options.Files << (sweep == 0 ? step : 0);
+      unsigned functionsPerFile = options.FunctionsPerFile << (sweep == 1 ? step : 0);
+
+      if(!RunCorpus(options, corpusDir.str(), group, fileCount, functionsPerFile, baseCost)){
+        break;
+      }
+    }
+  }
+
+  llvm::sys::fs::remove(JoinPath(corpusDir, "toolchain.txt"));
+
+  if(tempDir){
+    llvm::sys::fs::remove(corpusDir);
+  }
+}
@@ -7,6 +7,7 @@
 
 #include "clang/AST/Decl.h"
 #include "clang/AST/PrettyPrinter.h"
+#include "clang/AST/RecursiveASTVisitor.h"
 
 #include "clang/Frontend/CompilerInstance.h"
 
@@ -24,6 +25,10 @@ public:
     :SM(sm), Recorders(recorders), Verbose(verbose){
   }
 
+  llvm::StringRef getID() const override{
+    return "lua_CFunction";
+  }
+
   virtual void run(const MatchFinder::MatchResult &Result) {
 
     auto const* func = Result.Nodes.getDeclAs<clang::FunctionDecl>("id");
@@ -52,7 +57,176 @@ private:
   clang::SourceManager& SM;
 };
 
-clang::ASTConsumer* GetASTConsumer(clang::CompilerInstance& ci, RecorderCollection* recorders, bool Verbose){
+//Compile time description of the signature a function needs to have a recorder bound to it, a function 
+//returning the builtin type ReturnKind and taking a single pointer to a record named RecordName
+template<clang::BuiltinType::Kind ReturnKind, const char* RecordName>
+class BindingSignature{
+
+public:
+  BindingSignature() : Record(NULL){
+  }
+
+  bool Matches(const clang::FunctionDecl* func){
+
+    if(func->getNumParams() != 1){
+      return false;
+    }
+
+    //the return type has tobe spelled as the builtin type not a typedef of it
+    clang::QualType returnType = func->getReturnType();
+    auto builtinType = llvm::dyn_cast<clang::BuiltinType>(returnType.getTypePtr());
+
+    if(builtinType == NULL || builtinType->getKind() != ReturnKind || returnType.hasLocalQualifiers()){
+      return false;
+    }
+
+    auto paramType = func->getParamDecl(0)->getType();
+
+    if(!paramType->isAnyPointerType()){
+      return false;
+    }
+
+    auto recordType = paramType->getPointeeType()->getAs<clang::RecordType>();
+
+    if(recordType == NULL){
+      return false;
+    }
+
+    const clang::RecordDecl* record = recordType->getDecl()->getCanonicalDecl();
+
+    //once the record is resolved checking a parameter is just a pointer compare
+    if(record == Record){
+      return true;
+    }
+
+    if(record->getName() != RecordName){
+      return false;
+    }
+
+    if(Record == NULL){
+      Record = record;
+    }
+
+    return true;
+  }
+
+private:
+  const clang::RecordDecl* Record;
+};
+
+extern const char LuaStateName[] = "lua_State";
+
+//int f(lua_State* L)
+typedef BindingSignature<clang::BuiltinType::Int, LuaStateName> LuaCFunctionSignature;
+
+//Only visits FunctionDecls never descending into statements or types, which is all we need to find
+//functions that match a BindingSignature
+template<typename Signature>
+class SignatureVisitor : public clang::RecursiveASTVisitor<SignatureVisitor<Signature>>{
+
+public:
+  SignatureVisitor(clang::SourceManager& sm, RecorderCollection* recorders, bool verbose) 
+    :SM(sm), Recorders(recorders), Verbose(verbose){
+  }
+
+  bool TraverseDecl(clang::Decl* decl){
+
+    if(decl == NULL || IsOutsideAnnotatedFiles(decl)){
+      return true;
+    }
+
+    return clang::RecursiveASTVisitor<SignatureVisitor<Signature>>::TraverseDecl(decl);
+  }
+
+  bool TraverseStmt(clang::Stmt* stmt){
+    return true;
+  }
+
+  bool TraverseType(clang::QualType type){
+    return true;
+  }
+
+  bool TraverseTypeLoc(clang::TypeLoc typeLoc){
+    return true;
+  }
+
+  bool TraverseNestedNameSpecifierLoc(clang::NestedNameSpecifierLoc nameSpecifier){
+    return true;
+  }
+
+  bool VisitFunctionDecl(clang::FunctionDecl* func){
+
+    if(!FunctionSignature.Matches(func)){
+      return true;
+    }
+
+    if(Verbose){
+      int line = SM.getExpansionLineNumber(func->getLocStart());
+      auto name = func->getDeclName().getAsString();
+
+      std::cout << "ASTWalker: found function " << line << ": " << name << std::endl << std::endl;
+    }
+
+    Recorders->LuaCFunctionDefined(func);
+
+    return true;
+  }
+
+  bool shouldVisitTemplateInstantiations() const { return true; }
+  bool shouldVisitImplicitCode() const { return true; }
+
+private:
+  //Same pruning as MatchASTConsumer::setLocationFilter recorders can only be bound to functions in 
+  //the main file or files that contained LJFF_ directives
+  bool IsOutsideAnnotatedFiles(clang::Decl* decl){
+
+    if(llvm::isa<clang::TranslationUnitDecl>(decl) || llvm::isa<clang::NamespaceDecl>(decl) || llvm::isa<clang::LinkageSpecDecl>(decl)){
+      return false;
+    }
+
+    clang::SourceLocation location = decl->getLocation();
+
+    if(location.isInvalid()){
+      return false;
+    }
+
+    clang::FileID file = SM.getFileID(SM.getExpansionLoc(location));
+
+    return file != SM.getMainFileID() && !Recorders->AnnotatedFiles.count(file);
+  }
+
+  Signature FunctionSignature;
+  bool Verbose;
+  RecorderCollection* Recorders;
+  clang::SourceManager& SM;
+};
+
+class LuaCFunctionConsumer : public clang::ASTConsumer{
+
+public:
+  LuaCFunctionConsumer(clang::SourceManager& sm, RecorderCollection* recorders, bool verbose) 
+    :Visitor(sm, recorders, verbose){
+  }
+
+  bool HandleTopLevelDecl(clang::DeclGroupRef d) override{
+
+    for(auto decl : d){
+      Visitor.TraverseDecl(decl);
+    }
+
+    return true;
+  }
+
+private:
+  SignatureVisitor<LuaCFunctionSignature> Visitor;
+};
+
+clang::ASTConsumer* GetASTConsumer(clang::CompilerInstance& ci, RecorderCollection* recorders, bool Verbose, bool useMatchFinder,
+                                   llvm::StringMap<llvm::TimeRecord>* matcherTimes){
+
+  if(!useMatchFinder){
+    return new LuaCFunctionConsumer(ci.getSourceManager(), recorders, Verbose);
+  }
 
   using namespace clang::ast_matchers;    
   
@@ -61,11 +235,16 @@ clang::ASTConsumer* GetASTConsumer(clang::CompilerInstance& ci, RecorderCollecti
            returns(asString("int"))).bind("id");
 
   auto consumer = new MatchASTConsumer(ci.getASTContext());
+  consumer->setLocationFilter(&recorders->AnnotatedFiles);
 
-  consumer->addMatcher(m, new FunctionMatchCallback(ci.getSourceManager(), recorders, Verbose));
-
-  return consumer;
-}
+  if(matcherTimes != NULL){
+    consumer->enableProfiling(*matcherTimes);
+  }
 
+  auto callback = new FunctionMatchCallback(ci.getSourceManager(), recorders, Verbose);
 
+  consumer->addMatcher(m, callback);
+  consumer->takeCallbackOwnership(callback);
 
+  return consumer;
+}
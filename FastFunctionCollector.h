@@ -1,6 +1,8 @@
 #pragma once
 
 #include "MacroRecorder.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Timer.h"
 
 namespace clang{
   class CompilerInstance;
@@ -10,5 +12,9 @@ namespace clang{
 }
 
 
-clang::ASTConsumer* GetASTConsumer(clang::CompilerInstance& ci, RecorderCollection* recorders, bool Verbose);
+//Creates the consumer that binds recorders to the functions they're declared with, by default a specialized visitor
+//that only checks the signature of FunctionDecls is used, useMatchFinder uses the generic AST matcher path instead.
+//When matcherTimes is set the time spent in each matcher callback of the generic path is added to it
+clang::ASTConsumer* GetASTConsumer(clang::CompilerInstance& ci, RecorderCollection* recorders, bool Verbose, bool useMatchFinder = false,
+                                   llvm::StringMap<llvm::TimeRecord>* matcherTimes = NULL);
 
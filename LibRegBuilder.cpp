@@ -1,61 +1,289 @@
 #include "LibRegBuilder.h"
+#include "LuaStringHash.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
 
 using std::string;
 
-LibRegBuilder::LibRegBuilder(RecorderCollection* collectedMacros, const std::string& outputPath) : CollectedMacros(collectedMacros), 
-  CurrentObject(NULL), output(outputPath){
+LibRegBuilder::LibRegBuilder(const RecorderTable& table, const std::string& outputPath) : Table(table), 
+  CurrentObject(0), LazyObjects(false), DenseRecorders(false), PrehashKeys(false), KeyCollisions(0), OutputPath(outputPath), output(std::ios::binary){
 }
 
 
-void LibRegBuilder::WriteRecorderArray(std::vector<RecordEntry*>& functionList){
+//Looks up the FunctionId of a fast function from its address. Addresses are only known once the VM is running so the
+//hash is built once by InitLibFunctionHash, which Register_LuaLib calls. Functions are spread over buckets by one hash
+//and every bucket gets its own seed for a second hash that puts each of them in an empty slot, so a lookup is always
+//two hashes and one compare
+const char* FunctionIdHash = "#include <string.h>\n\
+#include <mutex>\n\
+\n\
+struct LibRecorderInfo{\n\
+  LibFuncParams::Recorder Recorder;\n\
+  LibFuncParams::Options Options;\n\
+  const char* Name;\n\
+};\n\
+\n\
+static uint16_t LibHashSeeds[LIB_HASH_BUCKETS];\n\
+static int32_t LibHashSlots[LIB_HASH_SLOTS];\n\
+//functions of buckets no seed could place, searched when the slot of a function doesn't match it\n\
+static int32_t LibHashOverflow[LIB_FUNCTION_COUNT];\n\
+static int LibHashOverflowCount = 0;\n\
+static std::once_flag LibHashOnce;\n\
+\n\
+static uint32_t LibHashPointer(LibFuncParams::Function func, uint32_t seed){\n\
+  uint64_t value = (uint64_t)(uintptr_t)func ^ (seed*0x9E3779B97F4A7C15ull);\n\
+  value = (value ^ (value >> 33))*0xFF51AFD7ED558CCDull;\n\
+  value = (value ^ (value >> 33))*0xC4CEB9FE1A85EC53ull;\n\
+  return (uint32_t)(value ^ (value >> 33));\n\
+}\n\
+\n\
+static bool PlaceLibHashBucket(const int32_t* ids, int count, uint32_t seed){\n\
+\n\
+  for(int i = 0; i != count ;i++){\n\
+    uint32_t slot = LibHashPointer(LibFunctionPointers[ids[i]], seed) & (LIB_HASH_SLOTS-1);\n\
+\n\
+    if(LibHashSlots[slot] != -1){\n\
+      for(int j = 0; j != i ;j++){\n\
+        LibHashSlots[LibHashPointer(LibFunctionPointers[ids[j]], seed) & (LIB_HASH_SLOTS-1)] = -1;\n\
+      }\n\
+      return false;\n\
+    }\n\
+\n\
+    LibHashSlots[slot] = ids[i];\n\
+  }\n\
+\n\
+  return true;\n\
+}\n\
+\n\
+static void BuildLibFunctionHash(){\n\
+\n\
+  static int32_t bucketIds[LIB_FUNCTION_COUNT];\n\
+  static int32_t bucketStart[LIB_HASH_BUCKETS+1];\n\
+  static int32_t bucketSize[LIB_HASH_BUCKETS];\n\
+  int maxBucketSize = 0;\n\
+\n\
+  memset(bucketStart, 0, sizeof(bucketStart));\n\
+  memset(LibHashSlots, 0xFF, sizeof(LibHashSlots));\n\
+\n\
+  for(int32_t id = 0; id != LIB_FUNCTION_COUNT ;id++){\n\
+    if(LibFunctionPointers[id] != NULL){\n\
+      bucketStart[(LibHashPointer(LibFunctionPointers[id], 0) % LIB_HASH_BUCKETS)+1]++;\n\
+    }\n\
+  }\n\
+\n\
+  for(int i = 0; i != LIB_HASH_BUCKETS ;i++){\n\
+    bucketStart[i+1] += bucketStart[i];\n\
+  }\n\
+\n\
+  memset(bucketSize, 0, sizeof(bucketSize));\n\
+\n\
+  for(int32_t id = 0; id != LIB_FUNCTION_COUNT ;id++){\n\
+    LibFuncParams::Function func = LibFunctionPointers[id];\n\
+\n\
+    if(func == NULL){\n\
+      continue;\n\
+    }\n\
+\n\
+    uint32_t bucket = LibHashPointer(func, 0) % LIB_HASH_BUCKETS;\n\
+    int32_t* ids = bucketIds+bucketStart[bucket];\n\
+    bool duplicate = false;\n\
+\n\
+    //the linker can fold identical functions into one address, they collide for every seed so only the first\n\
+    //id is kept and the address maps to it\n\
+    for(int i = 0; i != bucketSize[bucket] ;i++){\n\
+      duplicate = duplicate || LibFunctionPointers[ids[i]] == func;\n\
+    }\n\
+\n\
+    if(!duplicate){\n\
+      ids[bucketSize[bucket]++] = id;\n\
+      maxBucketSize = bucketSize[bucket] > maxBucketSize ? bucketSize[bucket] : maxBucketSize;\n\
+    }\n\
+  }\n\
+\n\
+  //the biggest buckets are placed first while most slots are still free\n\
+  for(int size = maxBucketSize; size != 0 ;size--){\n\
+    for(int bucket = 0; bucket != LIB_HASH_BUCKETS ;bucket++){\n\
+      if(bucketSize[bucket] != size){\n\
+        continue;\n\
+      }\n\
+\n\
+      uint32_t seed = 1;\n\
+\n\
+      while(seed != 0x10000 && !PlaceLibHashBucket(bucketIds+bucketStart[bucket], size, seed)){\n\
+        seed++;\n\
+      }\n\
+\n\
+      LibHashSeeds[bucket] = (uint16_t)seed;\n\
+\n\
+      if(seed == 0x10000){\n\
+        for(int i = 0; i != size ;i++){\n\
+          LibHashOverflow[LibHashOverflowCount++] = bucketIds[bucketStart[bucket]+i];\n\
+        }\n\
+      }\n\
+    }\n\
+  }\n\
+}\n\
+\n\
+//Called by Register_LuaLib, VMs created on different threads only build the hash once\n\
+void InitLibFunctionHash(){\n\
+  std::call_once(LibHashOnce, BuildLibFunctionHash);\n\
+}\n\
+\n\
+int GetLibFunctionId(LibFuncParams::Function func){\n\
+\n\
+  uint32_t bucket = LibHashPointer(func, 0) % LIB_HASH_BUCKETS;\n\
+  int32_t id = LibHashSlots[LibHashPointer(func, LibHashSeeds[bucket]) & (LIB_HASH_SLOTS-1)];\n\
+\n\
+  if(id != -1 && LibFunctionPointers[id] == func){\n\
+    return id;\n\
+  }\n\
+\n\
+  for(int i = 0; i != LibHashOverflowCount ;i++){\n\
+    if(LibFunctionPointers[LibHashOverflow[i]] == func){\n\
+      return LibHashOverflow[i];\n\
+    }\n\
+  }\n\
+\n\
+  return -1;\n\
+}\n\
+\n\
+const LibRecorderInfo* GetLibRecorder(LibFuncParams::Function func){\n\
+  int id = GetLibFunctionId(func);\n\
+  return id != -1 ? &LibRecorders[id] : NULL;\n\
+}\n\n";
+
+//Write the function pointers and recorders of every registered function in arrays indexed by their FunctionId like
+//LuaJIT's lj_ffdef.h and lj_recdef.h, ids of functions that failed to bind are left as empty entries
+void LibRegBuilder::WriteRecorderArray(){
+
+  std::vector<FuncIndex> byId;
+
+  auto addFunctions = [&](llvm::ArrayRef<FuncIndex> functions){
+    for(FuncIndex func : functions){
+      int id = Table.RecorderId[func];
+
+      if(!Table.IsValid(func) || id < 0){
+        continue;
+      }
+
+      if((size_t)id >= byId.size()){
+        byId.resize(id+1, (FuncIndex)-1);
+      }
+
+      byId[id] = func;
+    }
+  };
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+    addFunctions(Table.GetMemberFunctions(object));
+    addFunctions(Table.GetMetaFunctions(object));
+  }
+
+  addFunctions(Table.GlobalFunctions);
+
+  size_t slotCount = 1;
+
+  //at most half the slots are used so the seed search for each bucket stays short
+  while(slotCount < byId.size()*2){
+    slotCount *= 2;
+  }
+
+  output << "#define LIB_FUNCTION_COUNT " << std::max<size_t>(byId.size(), 1) << "\n";
+  output << "#define LIB_HASH_BUCKETS " << std::max<size_t>((byId.size()+3)/4, 1) << "\n";
+  output << "#define LIB_HASH_SLOTS " << slotCount << "\n\n";
+
+  output << "static const LibFuncParams::Function LibFunctionPointers[LIB_FUNCTION_COUNT] = {\n";
+
+  for(FuncIndex func : byId){
+    if(func != (FuncIndex)-1){
+      output << "  &" << Table.GetString(Table.FunctionName[func]) << ",\n";
+    }else{
+      output << "  NULL,\n";
+    }
+  }
+
+  output << (byId.empty() ? "  NULL,\n};\n\n" : "};\n\n");
+
+  output << "struct LibRecorderInfo;\n";
+  output << "extern const LibRecorderInfo LibRecorders[LIB_FUNCTION_COUNT];\n\n";
+  output << FunctionIdHash;
+
+  output << "const LibRecorderInfo LibRecorders[LIB_FUNCTION_COUNT] = {\n";
 
-  output << "RecorderInfo TraceRecorderInfo[] = {\n";
+  for(FuncIndex func : byId){
+    if(func != (FuncIndex)-1){
+      output << "  {&" << Table.GetString(Table.TraceRecorder[func]) << ", " << Table.GetString(Table.RecordOptions[func]) << ", \"" 
+             << Table.GetString(Table.FunctionName[func]) << "\"},\n";
+    }else{
+      output << "  {NULL, 0, NULL},\n";
+    }
+  }
+
+  output << (byId.empty() ? "  {NULL, 0, NULL},\n};\n\n" : "};\n\n");
+}
+
+void LibRegBuilder::WriteExtenList(){
 
-  for each (RecordEntry* entry in functionList){
-    output << "  {&" << entry->TraceRecorder << ", "<< entry->RecordOptions <<", \"" << entry->Name << "\"},\n";
+  output << "struct RecordFFData;\n";
+  output << "struct jit_State;\n\n";
+
+  for(StringId name : Table.FunctionName){
+    if(name == 0)continue;
+    output << "extern int " << Table.GetString(name) << "(lua_State* L);\n";
   }
 
-  output << "};\n\n";
+  output << "\n\n";
 }
 
-void LibRegBuilder::WriteExtenList(std::vector<RecordEntry*>& functionList){
+//same as WriteExtenList but only for the functions a file of the split output registers
+void LibRegBuilder::WriteExternList(llvm::ArrayRef<FuncIndex> functions){
 
   output << "struct RecordFFData;\n";
   output << "struct jit_State;\n\n";
 
-  for each (RecordEntry* var in functionList){
-    if(var->Name.empty())continue;
-    output << "extern int " << var->Name << "(lua_State* L);\n";
+  for(FuncIndex func : functions){
+    if(Table.FunctionName[func] != 0){
+      output << "extern int " << Table.GetString(Table.FunctionName[func]) << "(lua_State* L);\n";
+    }
   }
 
   output << "\n\n";
 }
 
 //write the header of the function that registers an objects member and meta functions table
-void LibRegBuilder::WriteRegObjectFunctionStart(const string& objectName){
+void LibRegBuilder::WriteRegObjectFunctionStart(const char* objectName){
 
   output << "void Register_" << objectName << "(lua_State* L, uint32_t options){\n";
 }
 
-void LibRegBuilder::WriteFunctionInit(RecordEntry& entry, const char* outputTable, int subNameStart){
+void LibRegBuilder::WriteFunctionInit(FuncIndex func, const char* outputTable, bool isMember){
   
-  if(!entry.Valid){
+  if(!Table.IsValid(func)){
     return;
   }
 
-  if(!entry.RequiredFlag.empty()){
-    output << "\n  if((options&" << entry.RequiredFlag << ") != 0){\n";
+  StringId requiredFlag = Table.RequiredFlag[func];
+  const char* name = Table.GetString(Table.FunctionName[func]);
+  auto pushes = Table.GetPushes(func);
+
+  if(requiredFlag != 0){
+    output << "\n  if((options&" << Table.GetString(requiredFlag) << ") != 0){\n";
   }else{
     output << "\n";
   }
 
-  for(size_t i = 0; i < entry.PushStack.size() ;i++){
-    const PushEntry& pushValue = entry.PushStack[i];
+  for(const PushEntry& pushValue : pushes){
 
     switch (pushValue.Type){
       case PushType_String:
-        output << "  lua_pushstring(L, \"" << (*pushValue.StringLiteral) << "\");\n";
+        output << "  lua_pushstring(L, \"" << pushValue.StringLiteral << "\");\n";
       break;
 
       case PushType_MemberTable:
@@ -65,9 +293,9 @@ void LibRegBuilder::WriteFunctionInit(RecordEntry& entry, const char* outputTabl
 
       case PushType_StaticMemberTable:
        // assert(CurrentObject->MemberFunctions.size() != 0);
-        output << "  lua_getfield(L, LUA_GLOBALSINDEX, \"" << CurrentObject->Name;
+        output << "  lua_getfield(L, LUA_GLOBALSINDEX, \"" << Table.GetString(Table.ObjectName[CurrentObject]);
 
-        if(CurrentObject->ObjectType == Object_CData){
+        if(Table.ObjectType[CurrentObject] == Object_CData){
           output << "_FFIIndex\");\n";
         }else{
           output << "\");\n";
@@ -75,11 +303,11 @@ void LibRegBuilder::WriteFunctionInit(RecordEntry& entry, const char* outputTabl
       break;
 
       case PushType_MT:
-        output << "  luaL_newmetatable(L, \"" << (*pushValue.StringLiteral) << "\");\n";
+        output << "  luaL_newmetatable(L, \"" << pushValue.StringLiteral << "\");\n";
       break;
 
       case PushType_Global:
-        output << "  lua_getfield(L, LUA_GLOBALSINDEX, \"" << (*pushValue.StringLiteral) << "\");\n";
+        output << "  lua_getfield(L, LUA_GLOBALSINDEX, \"" << pushValue.StringLiteral << "\");\n";
       break;
 
       case PushType_StackSlotBase:
@@ -96,13 +324,12 @@ void LibRegBuilder::WriteFunctionInit(RecordEntry& entry, const char* outputTabl
     }
   }
   
-  output << "  lua_pushcfastfunc(L, &" << entry.Name << ", " << entry.PushStack.size() << ",  &" << entry.TraceRecorder << ", "<< entry.RecordOptions <<", \"" << entry.Name << "\");\n";
+  output << "  lua_pushcfastfunc(L, &" << name << ", " << pushes.size() << ",  &" << Table.GetString(Table.TraceRecorder[func]) << ", "
+         << Table.GetString(Table.RecordOptions[func]) <<", \"" << name << "\");\n";
 
-  string& name = entry.Name.find('_') != string::npos ?  entry.Name.substr(subNameStart) : entry.Name;
+  output << "  lua_setfield(L, " << outputTable << ", \"" << (isMember ? Table.GetMemberName(func) : name) << "\");\n";
 
-  output << "  lua_setfield(L, " << outputTable << ", \"" << name << "\");\n";
-
-  if(!entry.RequiredFlag.empty()){
+  if(requiredFlag != 0){
     output << "  }\n";
   }
 }
@@ -117,7 +344,7 @@ extern \"C\"{\n\
 
 void LibRegBuilder::WriteTableCreate(const std::string& tableName, int size, const std::string& destTable, const std::string& destKey, int arraySize){
 
-  if(CurrentObject->ObjectType == Object_CData){
+  if(Table.ObjectType[CurrentObject] == Object_CData){
     
   }
 
@@ -136,106 +363,1029 @@ void LibRegBuilder::WriteCDataMtCreate(int size, const std::string& typeId){
 }
 
 bool LibRegBuilder::RecordersValid(){
+  return Table.RecordersValid();
+}
 
-  for each (RecordEntry* var in CollectedMacros->AllFunctions){
-    if(!var->Valid){
-      return false;
-    }
-  }
+//Same as the VM's GetOrCreateTable except a new table is created with its hash part already big enough for every
+//function that gets added to it, so registering them never rehashes it
+const char* SizedTableHelper = "static inline int GetOrCreateSizedTable(lua_State* L, int index, const char* name, int hashSize){\n\
+  lua_getfield(L, index, name);\n\
+\n\
+  if(lua_isnil(L, -1)){\n\
+    lua_pop(L, 1);\n\
+    lua_createtable(L, 0, hashSize);\n\
+    lua_pushvalue(L, -1);\n\
+    lua_setfield(L, index, name);\n\
+  }\n\
+\n\
+  return lua_gettop(L);\n\
+}\n\n";
 
-  return true;
-}
+//The parameter types of lua_pushcfastfunc, the descriptor and recorder tables use them so they always match how the
+//VM declares it
+const char* FastFuncTypes = "#include <tuple>\n\
+\n\
+template<typename T> struct FastFuncParams;\n\
+\n\
+template<typename R, typename... Args> struct FastFuncParams<R(*)(Args...)>{\n\
+  typedef typename std::tuple_element<1, std::tuple<Args...>>::type Function;\n\
+  typedef typename std::tuple_element<3, std::tuple<Args...>>::type Recorder;\n\
+  typedef typename std::tuple_element<4, std::tuple<Args...>>::type Options;\n\
+};\n\
+\n\
+typedef FastFuncParams<decltype(&lua_pushcfastfunc)> LibFuncParams;\n\n";
 
-void LibRegBuilder::WriteLibReg(std::vector<string>& includeList){
+void LibRegBuilder::WriteIncludes(const std::vector<string>& includeList){
 
   output << HeaderList;
 
   for(auto include = includeList.begin(); include != includeList.end() ;include++){
     output << "#include \"" << *include << "\"\n";
   }
+}
+
+void LibRegBuilder::WriteFileStart(const std::vector<string>& includeList, bool useTables){
 
-  WriteExtenList(CollectedMacros->AllFunctions);
+  WriteIncludes(includeList);
+  WriteExtenList();
 
-  //WriteRecorderArray(CollectedMacros->AllFunctions);
+  output << SizedTableHelper;
 
-  auto start = CollectedMacros->ObjectFunctions.begin();
-  auto end = CollectedMacros->ObjectFunctions.end();
+  if(useTables || DenseRecorders){
+    output << FastFuncTypes;
+  }
+}
 
-  for(auto objectEntry = start; objectEntry != end ;objectEntry++){
+//write the start of an objects registration function up to where its functions get added to its tables
+void LibRegBuilder::WriteObjectStart(ObjectIndex object){
 
-    CurrentObject = objectEntry->second;
+  CurrentObject = object;
 
-    WriteRegObjectFunctionStart(objectEntry->first);
+  const char* objectName = Table.GetString(Table.ObjectName[object]);
+  auto metaList = Table.GetMetaFunctions(object);
 
-    auto& memberList = objectEntry->second->MemberFunctions;
-    auto& metaList = objectEntry->second->MetaFunctions;
+  //functions that need a flag are counted as well so the tables are big enough with every option enabled
+  size_t memberCount = Table.CountValid(Table.GetMemberFunctions(object));
+  size_t metaCount = Table.CountValid(metaList);
+
+  WriteRegObjectFunctionStart(objectName);
    
-    //Create a the members table for this object if it has any member functions defined and also store
-    //the created table in the members list table thats on the Lua stack at mtList+1
-    if(CurrentObject->NeedsMemberTable){
-
-      if(CurrentObject->ObjectType == Object_CData){
-        output << "  int memberTable = GetOrCreateTable(L, LUA_GLOBALSINDEX,\"" << objectEntry->first << "_FFIIndex\");\n";
-      }else{
-        output << "  int memberTable = GetOrCreateTable(L, LUA_GLOBALSINDEX,\"" << objectEntry->first << "\");\n";
-      }
-    }
+  //Create a the members table for this object if it has any member functions defined and also store
+  //the created table in the members list table thats on the Lua stack at mtList+1
+  if(Table.ObjectFlag[object] & ObjectFlag_NeedsMemberTable){
 
-    //Create a the metatable for this object if it has any metamethods defined also store the created 
-    //table in the metatable list table thats on the Lua stack at the index contained in mtList
-    if(metaList.size() != 0){
-      if(CurrentObject->ObjectType == Object_CData){
-        //WriteCDataMtCreate(metaList.size()*2, "(libFlags >> 16)");
-        WriteTableCreate("metaTable", metaList.size(), "LUA_GLOBALSINDEX", objectEntry->first+"MT", 0);
-      }else{
-        output << "  int metaTable = GetOrCreateTable(L, LUA_REGISTRYINDEX,\"" << objectEntry->first << "\");\n";
-      }
+    if(Table.ObjectType[object] == Object_CData){
+      output << "  int memberTable = GetOrCreateSizedTable(L, LUA_GLOBALSINDEX,\"" << objectName << "_FFIIndex\", " << memberCount << ");\n";
+    }else{
+      output << "  int memberTable = GetOrCreateSizedTable(L, LUA_GLOBALSINDEX,\"" << objectName << "\", " << memberCount << ");\n";
     }
+  }
 
-    if(memberList.size() != 0){
-      for each (RecordEntry* var in memberList){
-        WriteFunctionInit(*var, "memberTable", objectEntry->first.size()+1);
-      }
+  //Create a the metatable for this object if it has any metamethods defined also store the created 
+  //table in the metatable list table thats on the Lua stack at the index contained in mtList
+  if(metaList.size() != 0){
+    if(Table.ObjectType[object] == Object_CData){
+      //WriteCDataMtCreate(metaList.size()*2, "(libFlags >> 16)");
+      WriteTableCreate("metaTable", metaCount, "LUA_GLOBALSINDEX", string(objectName)+"MT", 0);
+    }else{
+      output << "  int metaTable = GetOrCreateSizedTable(L, LUA_REGISTRYINDEX,\"" << objectName << "\", " << metaCount << ");\n";
     }
+  }
+}
+
+void LibRegBuilder::WriteObjectEnd(ObjectIndex object){
+
+  //clear the memberTable and/or metaTable tables off the stack if they were created for this object since were
+  //at the end of this objects registration function
+  if(Table.GetMemberFunctions(object).size() != 0 && Table.GetMetaFunctions(object).size() != 0){
+    output << "  lua_pop(L, 2);\n";
+  }else{
+    output << "  lua_pop(L, 1);\n";
+  }
+
+  output << "}\n\n";
+}
+
+//build the main exported registration function that calls all the other object registration functions
+//Registers objects the first time they're used. Each object's member table starts out as an empty placeholder whose
+//metatable runs its Register_ function the first time a missing key is read from it. A metatable is given to the
+//registry as well so the first lookup of an object's metatable by name registers the object too
+const char* LazyRegistration = "struct LazyObject{\n\
+  const char* Name;\n\
+  void (*Register)(lua_State* L, uint32_t options);\n\
+  int MemberCount;\n\
+};\n\
+\n\
+static void RegisterLazyObject(lua_State* L, int pending, uint32_t options, const char* name){\n\
+\n\
+  lua_getfield(L, pending, name);\n\
+  const LazyObject* object = (const LazyObject*)lua_touserdata(L, -1);\n\
+  lua_pop(L, 1);\n\
+\n\
+  if(object == NULL){\n\
+    return;\n\
+  }\n\
+\n\
+  lua_pushnil(L);\n\
+  lua_setfield(L, pending, name);\n\
+\n\
+  //drop the trigger from the placeholder before Register_ fills it in\n\
+  if(object->MemberCount != 0){\n\
+    lua_getfield(L, LUA_GLOBALSINDEX, name);\n\
+    lua_pushnil(L);\n\
+    lua_setmetatable(L, -2);\n\
+    lua_pop(L, 1);\n\
+  }\n\
+\n\
+  object->Register(L, options);\n\
+}\n\
+\n\
+static int LazyMemberIndex(lua_State* L){\n\
+  RegisterLazyObject(L, lua_upvalueindex(1), (uint32_t)lua_tonumber(L, lua_upvalueindex(2)), lua_tostring(L, lua_upvalueindex(3)));\n\
+  lua_rawget(L, 1);\n\
+  return 1;\n\
+}\n\
+\n\
+static int LazyRegistryIndex(lua_State* L){\n\
+\n\
+  if(lua_type(L, 2) == LUA_TSTRING){\n\
+    RegisterLazyObject(L, lua_upvalueindex(1), (uint32_t)lua_tonumber(L, lua_upvalueindex(2)), lua_tostring(L, 2));\n\
+  }\n\
+\n\
+  lua_rawget(L, 1);\n\
+  return 1;\n\
+}\n\
+\n\
+static void RegisterLazyObjects(lua_State* L, uint32_t options, const LazyObject* objects, size_t count){\n\
+\n\
+  lua_createtable(L, 0, (int)count);\n\
+  int pending = lua_gettop(L);\n\
+\n\
+  for(size_t i = 0; i != count ;i++){\n\
+    lua_pushlightuserdata(L, (void*)&objects[i]);\n\
+    lua_setfield(L, pending, objects[i].Name);\n\
+  }\n\
+\n\
+  for(size_t i = 0; i != count ;i++){\n\
+    if(objects[i].MemberCount == 0){\n\
+      continue;\n\
+    }\n\
+\n\
+    int table = GetOrCreateSizedTable(L, LUA_GLOBALSINDEX, objects[i].Name, objects[i].MemberCount);\n\
+\n\
+    //a table something else already gave a metatable can't have a trigger so its object is registered now\n\
+    if(lua_getmetatable(L, table)){\n\
+      lua_pop(L, 2);\n\
+      lua_pushnil(L);\n\
+      lua_setfield(L, pending, objects[i].Name);\n\
+      objects[i].Register(L, options);\n\
+      continue;\n\
+    }\n\
+\n\
+    lua_createtable(L, 0, 1);\n\
+    lua_pushvalue(L, pending);\n\
+    lua_pushnumber(L, options);\n\
+    lua_pushstring(L, objects[i].Name);\n\
+    lua_pushcclosure(L, LazyMemberIndex, 3);\n\
+    lua_setfield(L, -2, \"__index\");\n\
+    lua_setmetatable(L, table);\n\
+    lua_pop(L, 1);\n\
+  }\n\
+\n\
+  lua_createtable(L, 0, 1);\n\
+  lua_pushvalue(L, pending);\n\
+  lua_pushnumber(L, options);\n\
+  lua_pushcclosure(L, LazyRegistryIndex, 2);\n\
+  lua_setfield(L, -2, \"__index\");\n\
+  lua_setmetatable(L, LUA_REGISTRYINDEX);\n\
+  lua_pop(L, 1);\n\
+}\n\n";
+
+//Interns every key of the member and metatables in one pass at the start of Register_LuaLib. The key table stays in
+//the registry so each Register_ function, including ones lazy registration runs later, sets its keys from the
+//already hashed strings instead of hashing the literal again
+const char* KeyInterning = "static void InternLibKeys(lua_State* L){\n\
+\n\
+  lua_createtable(L, LIB_KEY_COUNT, 0);\n\
+\n\
+  for(int i = 0; i != LIB_KEY_COUNT ;i++){\n\
+    lua_pushstring(L, LibKeyNames[i]);\n\
+    lua_rawseti(L, -2, i+1);\n\
+  }\n\
+\n\
+  lua_setfield(L, LUA_REGISTRYINDEX, \"LibRegKeys\");\n\
+}\n\n";
+
+void LibRegBuilder::WriteRegisterLuaLib(bool unrolled, const string& registerGlobals){
+
+  size_t lazyCount = 0;
+
+  if(LazyObjects){
+    output << LazyRegistration;
 
-    if(metaList.size() != 0){
-      for each (RecordEntry* var in metaList){
-        WriteFunctionInit(*var, "metaTable", objectEntry->first.size()+1);
+    for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+      if(Table.ObjectType[object] == Object_CData){
+        continue;
       }
+
+      const char* objectName = Table.GetString(Table.ObjectName[object]);
+      //objects without a member table are only triggered through their metatable
+      size_t memberCount = (Table.ObjectFlag[object] & ObjectFlag_NeedsMemberTable) ? std::max<size_t>(Table.CountValid(Table.GetMemberFunctions(object)), 1) : 0;
+
+      output << (lazyCount == 0 ? "static const LazyObject LazyObjects[] = {\n" : "");
+      output << "  {\"" << objectName << "\", &Register_" << objectName << ", " << memberCount << "},\n";
+      lazyCount++;
     }
 
-    //clear the memberTable and/or metaTable tables off the stack if they were created for this object since were
-    //at the end of this objects registration function
-    if(memberList.size() != 0 && metaList.size() != 0){
-      output << "  lua_pop(L, 2);\n";
-    }else{
-      output << "  lua_pop(L, 1);\n";
+    output << (lazyCount != 0 ? "};\n\n" : "");
+  }
+
+  if(DenseRecorders){
+    WriteRecorderArray();
+  }
+
+  if(!KeyNames.empty()){
+    output << "#define LIB_KEY_COUNT " << KeyNames.size() << "\n\n";
+    output << "static const char* const LibKeyNames[LIB_KEY_COUNT] = {\n";
+
+    for(const char* key : KeyNames){
+      output << "  \"" << key << "\",\n";
     }
 
-    output << "}\n\n";
+    output << "};\n\n" << KeyInterning;
   }
 
   output << "extern int MTListMarker, MembersListMarker;\n\n";
 
-  //build the main exported registration function that calls all the other object registration functions
   output << "void Register_LuaLib(lua_State* L, uint32_t options){\n\n";
 
+  if(DenseRecorders){
+    output << "  InitLibFunctionHash();\n";
+  }
 
-  if(CollectedMacros->GobalFunctions.size() != 0){
-    
-    for each (RecordEntry* var in CollectedMacros->GobalFunctions){
-      WriteFunctionInit(*var, "libTable", 0);
+  //has to come before the lazy registration hooks the registry
+  if(!KeyNames.empty()){
+    output << "  InternLibKeys(L);\n";
+  }
+
+  if(unrolled){
+    for(FuncIndex func : Table.GlobalFunctions){
+      WriteFunctionInit(func, "libTable", false);
     }
+  }else if(!registerGlobals.empty()){
+    output << "  " << registerGlobals << ";\n";
+  }
+
+  if(lazyCount != 0){
+    output << "  RegisterLazyObjects(L, options, LazyObjects, " << lazyCount << ");\n";
   }
 
   //emit all the calls to the object registration functions we created earlier
-  for(auto objectEntry = start; objectEntry != end ;objectEntry++){
-    if(objectEntry->second->ObjectType != Object_CData){
-      output << "  Register_" << objectEntry->first << "(L, options);\n";
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() && !LazyObjects ;object++){
+    if(Table.ObjectType[object] != Object_CData){
+      output << "  Register_" << Table.GetString(Table.ObjectName[object]) << "(L, options);\n";
     }
   }
 
   output << "  lua_pop(L, 2);\n}\n\n";
-  
-  output.flush();
+}
+
+void LibRegBuilder::WriteLibReg(const std::vector<string>& includeList){
+
+  WriteFileStart(includeList, false);
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+
+    WriteObjectStart(object);
+
+    for(FuncIndex func : Table.GetMemberFunctions(object)){
+      WriteFunctionInit(func, "memberTable", true);
+    }
+
+    for(FuncIndex func : Table.GetMetaFunctions(object)){
+      WriteFunctionInit(func, "metaTable", true);
+    }
+
+    WriteObjectEnd(object);
+  }
+
+  WriteRegisterLuaLib(true);
+}
+
+//Types of the registration descriptors and the loop that registers them
+const char* RegistrationTypes = "enum LibUpvalueType{\n\
+  LibUpvalue_String,\n\
+  LibUpvalue_Global,\n\
+  LibUpvalue_MT,\n\
+  LibUpvalue_MemberTable,\n\
+  LibUpvalue_StackSlot,\n\
+  LibUpvalue_StackSlotBase,\n\
+};\n\
+\n\
+struct LibUpvalue{\n\
+  int Type;\n\
+  int Slot;\n\
+  const char* Name;\n\
+};\n\
+\n\
+struct LibFunction{\n\
+  const char* Key;\n\
+  const char* Name;\n\
+  LibFuncParams::Function Func;\n\
+  LibFuncParams::Recorder Recorder;\n\
+  LibFuncParams::Options Options;\n\
+  uint32_t RequiredFlags;\n\
+  uint32_t UpvalueStart, UpvalueCount;\n\
+  //index of the key in the interned key table, 0 when it's set by name\n\
+  uint32_t KeyId;\n\
+};\n\n";
+
+const char* RegistrationLoop = "static void RegisterLibFunctions(lua_State* L, uint32_t options, int table, int memberTable, int keyTable, const LibFunction* functions, size_t count){\n\
+\n\
+  for(size_t i = 0; i != count ;i++){\n\
+    const LibFunction& func = functions[i];\n\
+\n\
+    if(func.RequiredFlags != 0 && (options&func.RequiredFlags) == 0){\n\
+      continue;\n\
+    }\n\
+\n\
+    for(uint32_t j = func.UpvalueStart; j != func.UpvalueStart+func.UpvalueCount ;j++){\n\
+      const LibUpvalue& upvalue = LibUpvalues[j];\n\
+\n\
+      switch(upvalue.Type){\n\
+        case LibUpvalue_String:\n\
+          lua_pushstring(L, upvalue.Name);\n\
+          break;\n\
+        case LibUpvalue_Global:\n\
+          lua_getfield(L, LUA_GLOBALSINDEX, upvalue.Name);\n\
+          break;\n\
+        case LibUpvalue_MT:\n\
+          luaL_newmetatable(L, upvalue.Name);\n\
+          break;\n\
+        case LibUpvalue_MemberTable:\n\
+          lua_pushvalue(L, memberTable);\n\
+          break;\n\
+        case LibUpvalue_StackSlot:\n\
+          lua_pushvalue(L, -upvalue.Slot);\n\
+          break;\n\
+        case LibUpvalue_StackSlotBase:\n\
+          lua_pushvalue(L, upvalue.Slot);\n\
+          break;\n\
+      }\n\
+    }\n\
+\n\
+    lua_pushcfastfunc(L, func.Func, func.UpvalueCount, func.Recorder, func.Options, func.Name);\n\
+\n\
+    if(func.KeyId != 0){\n\
+      lua_rawgeti(L, keyTable, func.KeyId);\n\
+      lua_insert(L, -2);\n\
+      lua_rawset(L, table);\n\
+    }else{\n\
+      lua_setfield(L, table, func.Key);\n\
+    }\n\
+  }\n\
+}\n\n";
+
+//Order the functions of a presized table so every key that can have its main node is inserted before any key that
+//collides with it. LuaJIT moves a colliding node out of a main node when that node's own key gets inserted, so this
+//way each key is put in its final node the first time. The order only affects the speed of registering them
+std::vector<FuncIndex> LibRegBuilder::OrderByMainNode(llvm::ArrayRef<FuncIndex> functions){
+
+  uint32_t hashMask = LuaHashPartSize((uint32_t)Table.CountValid(functions))-1;
+  std::vector<FuncIndex> mainNodes, colliding;
+  std::vector<bool> usedNodes(hashMask+1, false);
+
+  for(FuncIndex func : functions){
+    if(!Table.IsValid(func)){
+      continue;
+    }
+
+    uint32_t node = LuaStringHash(Table.GetMemberName(func)) & hashMask;
+
+    if(!usedNodes[node]){
+      usedNodes[node] = true;
+      mainNodes.push_back(func);
+    }else{
+      colliding.push_back(func);
+    }
+  }
+
+  KeyCollisions += colliding.size();
+  mainNodes.insert(mainNodes.end(), colliding.begin(), colliding.end());
+
+  return mainNodes;
+}
+
+uint32_t LibRegBuilder::GetKeyId(const char* key){
+
+  auto entry = KeyIds.insert(std::make_pair(key, (uint32_t)KeyNames.size()+1));
+
+  if(entry.second){
+    KeyNames.push_back(key);
+  }
+
+  return entry.first->second;
+}
+
+//write the pushes of the functions of an object or the globals when object is -1 to the shared upvalue array
+void LibRegBuilder::WriteUpvalues(llvm::ArrayRef<FuncIndex> functions, int object, std::vector<uint32_t>& upvalueStart, uint32_t& upvalueCount){
+
+  for(FuncIndex func : functions){
+    if(!Table.IsValid(func)){
+      continue;
+    }
+
+    upvalueStart[func] = upvalueCount;
+
+    for(const PushEntry& pushValue : Table.GetPushes(func)){
+      switch(pushValue.Type){
+        case PushType_String:
+          output << "  {LibUpvalue_String, 0, \"" << pushValue.StringLiteral << "\"},\n";
+        break;
+
+        case PushType_MemberTable:
+          output << "  {LibUpvalue_MemberTable, 0, NULL},\n";
+        break;
+
+        //the static member table is just a global lookup with the name of the object's member table
+        case PushType_StaticMemberTable:
+          assert(object != -1 && "static member table push outside of an object");
+          output << "  {LibUpvalue_Global, 0, \"" << Table.GetString(Table.ObjectName[object]);
+          output << (Table.ObjectType[object] == Object_CData ? "_FFIIndex\"},\n" : "\"},\n");
+        break;
+
+        case PushType_MT:
+          output << "  {LibUpvalue_MT, 0, \"" << pushValue.StringLiteral << "\"},\n";
+        break;
+
+        case PushType_Global:
+          output << "  {LibUpvalue_Global, 0, \"" << pushValue.StringLiteral << "\"},\n";
+        break;
+
+        case PushType_StackSlotBase:
+          output << "  {LibUpvalue_StackSlotBase, " << pushValue.StackSlot << ", NULL},\n";
+        break;
+
+        case PushType_StackSlot:
+          output << "  {LibUpvalue_StackSlot, " << pushValue.StackSlot << ", NULL},\n";
+        break;
+
+        default:
+          assert(false && "unknown push type");
+        break;
+      }
+
+      upvalueCount++;
+    }
+  }
+}
+
+//write a constant descriptor array for the valid functions in the list, returns how many were written
+size_t LibRegBuilder::WriteFunctionTable(const string& arrayName, llvm::ArrayRef<FuncIndex> functions, bool isMember, 
+                                         const std::vector<uint32_t>& upvalueStart){
+
+  size_t count = 0;
+  //only the member and metatables are presized so the globals keep their order and are set by name
+  bool prehash = PrehashKeys && isMember;
+  std::vector<FuncIndex> ordered = prehash ? OrderByMainNode(functions) : std::vector<FuncIndex>(functions.begin(), functions.end());
+
+  for(FuncIndex func : ordered){
+    if(!Table.IsValid(func)){
+      continue;
+    }
+
+    if(count == 0){
+      output << "static const LibFunction " << arrayName << "[] = {\n";
+    }
+
+    const char* name = Table.GetString(Table.FunctionName[func]);
+    const char* key = isMember ? Table.GetMemberName(func) : name;
+    StringId requiredFlag = Table.RequiredFlag[func];
+
+    output << "  {\"" << key << "\", \"" << name << "\", &" << name << ", &" 
+           << Table.GetString(Table.TraceRecorder[func]) << ", " << Table.GetString(Table.RecordOptions[func]) << ", " 
+           << (requiredFlag != 0 ? Table.GetString(requiredFlag) : "0") << ", " << upvalueStart[func] << ", " << Table.GetPushes(func).size() << ", "
+           << (prehash ? GetKeyId(key) : 0) << "},\n";
+    count++;
+  }
+
+  if(count != 0){
+    output << "};\n\n";
+  }
+
+  return count;
+}
+
+void LibRegBuilder::WriteLibRegTables(const std::vector<string>& includeList){
+
+  WriteFileStart(includeList, true);
+
+  output << RegistrationTypes;
+
+  std::vector<uint32_t> upvalueStart(Table.GetFunctionCount(), 0);
+  uint32_t upvalueCount = 0;
+
+  output << "static const LibUpvalue LibUpvalues[] = {\n";
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+    WriteUpvalues(Table.GetMemberFunctions(object), object, upvalueStart, upvalueCount);
+    WriteUpvalues(Table.GetMetaFunctions(object), object, upvalueStart, upvalueCount);
+  }
+
+  WriteUpvalues(Table.GlobalFunctions, -1, upvalueStart, upvalueCount);
+
+  //keeps the array from being empty
+  output << "  {LibUpvalue_String, 0, NULL},\n};\n\n";
+
+  output << RegistrationLoop;
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+
+    string objectName = Table.GetString(Table.ObjectName[object]);
+    size_t memberCount = WriteFunctionTable("LibMembers_"+objectName, Table.GetMemberFunctions(object), true, upvalueStart);
+    size_t metaCount = WriteFunctionTable("LibMeta_"+objectName, Table.GetMetaFunctions(object), true, upvalueStart);
+    
+    const char* memberTable = (Table.ObjectFlag[object] & ObjectFlag_NeedsMemberTable) ? "memberTable" : "0";
+    bool keyTable = PrehashKeys && (memberCount != 0 || metaCount != 0);
+
+    WriteObjectStart(object);
+
+    if(keyTable){
+      output << "  lua_getfield(L, LUA_REGISTRYINDEX, \"LibRegKeys\");\n";
+      output << "  int keyTable = lua_gettop(L);\n";
+    }
+
+    if(memberCount != 0){
+      output << "  RegisterLibFunctions(L, options, memberTable, memberTable, " << (keyTable ? "keyTable" : "0") << ", LibMembers_" 
+             << objectName << ", " << memberCount << ");\n";
+    }
+
+    if(metaCount != 0){
+      output << "  RegisterLibFunctions(L, options, metaTable, " << memberTable << ", " << (keyTable ? "keyTable" : "0") << ", LibMeta_" 
+             << objectName << ", " << metaCount << ");\n";
+    }
+
+    if(keyTable){
+      output << "  lua_pop(L, 1);\n";
+    }
+
+    WriteObjectEnd(object);
+  }
+
+  size_t globalCount = WriteFunctionTable("LibGlobalFunctions", Table.GlobalFunctions, false, upvalueStart);
+
+  string registerGlobals;
+
+  if(globalCount != 0){
+    registerGlobals = "RegisterLibFunctions(L, options, libTable, 0, 0, LibGlobalFunctions, "+std::to_string(globalCount)+")";
+  }
+
+  WriteRegisterLuaLib(false, registerGlobals);
+}
+
+//Flags in the header of an object's stream, the loader gets them from the same values
+enum LibStreamFlags{
+  LibStream_MemberTable = 1,
+  LibStream_MetaTable = 2,
+  LibStream_CData = 4,
+};
+
+//The fixed loader the stream backend registers everything with. A stream lists the functions of one object or the
+//globals in the same order as LibStreamFuncs, which holds the parts of them that have to be addresses or constants
+const char* StreamLoader = "struct LibStreamFunc{\n\
+  LibFuncParams::Function Func;\n\
+  LibFuncParams::Recorder Recorder;\n\
+  LibFuncParams::Options Options;\n\
+  uint32_t RequiredFlags;\n\
+};\n\
+\n\
+static uint32_t ReadLibStreamULEB(const uint8_t*& p){\n\
+\n\
+  uint32_t value = *p++;\n\
+\n\
+  if(value >= 0x80){\n\
+    int shift = 0;\n\
+    value &= 0x7f;\n\
+\n\
+    do{\n\
+      shift += 7;\n\
+      value |= (uint32_t)(*p & 0x7f) << shift;\n\
+    }while(*p++ >= 0x80);\n\
+  }\n\
+\n\
+  return value;\n\
+}\n\
+\n\
+static const char* ReadLibStreamString(const uint8_t*& p){\n\
+  const char* value = (const char*)p;\n\
+  p += strlen(value)+1;\n\
+  return value;\n\
+}\n\
+\n\
+static const uint8_t* LoadLibFunctions(lua_State* L, uint32_t options, int table, int memberTable, const uint8_t* p, \n\
+                                       const LibStreamFunc* func, uint32_t count){\n\
+\n\
+  for(uint32_t i = 0; i != count ;i++, func++){\n\
+    uint32_t keyOffset = ReadLibStreamULEB(p);\n\
+    const char* name = ReadLibStreamString(p);\n\
+    uint32_t upvalueCount = *p++;\n\
+    bool enabled = func->RequiredFlags == 0 || (options&func->RequiredFlags) != 0;\n\
+\n\
+    for(uint32_t j = 0; j != upvalueCount ;j++){\n\
+      int type = *p++;\n\
+      const char* value = NULL;\n\
+      int slot = 0;\n\
+\n\
+      if(type == LibStreamPush_String || type == LibStreamPush_Global || type == LibStreamPush_MT){\n\
+        value = ReadLibStreamString(p);\n\
+      }else if(type == LibStreamPush_StackSlot || type == LibStreamPush_StackSlotBase){\n\
+        slot = (int)ReadLibStreamULEB(p);\n\
+      }\n\
+\n\
+      if(!enabled){\n\
+        continue;\n\
+      }\n\
+\n\
+      switch(type){\n\
+        case LibStreamPush_String:\n\
+          lua_pushstring(L, value);\n\
+          break;\n\
+        case LibStreamPush_Global:\n\
+          lua_getfield(L, LUA_GLOBALSINDEX, value);\n\
+          break;\n\
+        case LibStreamPush_MT:\n\
+          luaL_newmetatable(L, value);\n\
+          break;\n\
+        case LibStreamPush_MemberTable:\n\
+          lua_pushvalue(L, memberTable);\n\
+          break;\n\
+        case LibStreamPush_StackSlot:\n\
+          lua_pushvalue(L, -slot);\n\
+          break;\n\
+        case LibStreamPush_StackSlotBase:\n\
+          lua_pushvalue(L, slot);\n\
+          break;\n\
+      }\n\
+    }\n\
+\n\
+    if(enabled){\n\
+      lua_pushcfastfunc(L, func->Func, upvalueCount, func->Recorder, func->Options, name);\n\
+      lua_setfield(L, table, name+keyOffset);\n\
+    }\n\
+  }\n\
+\n\
+  return p;\n\
+}\n\
+\n\
+static void LoadLibObject(lua_State* L, uint32_t options, const uint8_t* p, const LibStreamFunc* funcs){\n\
+\n\
+  int flags = *p++;\n\
+  funcs += ReadLibStreamULEB(p);\n\
+  uint32_t memberCount = ReadLibStreamULEB(p);\n\
+  uint32_t metaCount = ReadLibStreamULEB(p);\n\
+  const char* memberName = ReadLibStreamString(p);\n\
+  const char* metaName = ReadLibStreamString(p);\n\
+  int top = lua_gettop(L), memberTable = 0, metaTable = 0;\n\
+\n\
+  if(flags & LibStream_MemberTable){\n\
+    memberTable = GetOrCreateSizedTable(L, LUA_GLOBALSINDEX, memberName, memberCount);\n\
+  }\n\
+\n\
+  if((flags & LibStream_MetaTable) && (flags & LibStream_CData)){\n\
+    lua_createtable(L, 0, metaCount);\n\
+    lua_pushvalue(L, -1);\n\
+    lua_setfield(L, LUA_GLOBALSINDEX, metaName);\n\
+    metaTable = lua_gettop(L);\n\
+  }else if(flags & LibStream_MetaTable){\n\
+    metaTable = GetOrCreateSizedTable(L, LUA_REGISTRYINDEX, metaName, metaCount);\n\
+  }\n\
+\n\
+  p = LoadLibFunctions(L, options, memberTable, memberTable, p, funcs, memberCount);\n\
+  LoadLibFunctions(L, options, metaTable, memberTable, p, funcs+memberCount, metaCount);\n\
+\n\
+  lua_settop(L, top);\n\
+}\n\n";
+
+static void PutStreamULEB(string& stream, uint32_t value){
+
+  while(value >= 0x80){
+    stream += (char)((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+
+  stream += (char)value;
+}
+
+static void PutStreamString(string& stream, StringRef value){
+  stream.append(value.data(), value.size());
+  stream += '\0';
+}
+
+//append the functions of the list to the stream and their descriptors to LibStreamFuncs, returns how many were added
+size_t LibRegBuilder::WriteStreamFunctions(string& stream, llvm::ArrayRef<FuncIndex> functions, int object, std::ostringstream& funcs){
+
+  size_t count = 0;
+
+  for(FuncIndex func : functions){
+    if(!Table.IsValid(func)){
+      continue;
+    }
+
+    const char* name = Table.GetString(Table.FunctionName[func]);
+    StringId requiredFlag = Table.RequiredFlag[func];
+    auto pushes = Table.GetPushes(func);
+
+    assert(pushes.size() < 256 && "too many upvalues for a stream function");
+
+    PutStreamULEB(stream, object != -1 ? Table.MemberNameStart[func] : 0);
+    PutStreamString(stream, name);
+    stream += (char)pushes.size();
+
+    for(const PushEntry& pushValue : pushes){
+      switch(pushValue.Type){
+        case PushType_String:
+        case PushType_MT:
+        case PushType_Global:
+          stream += (char)pushValue.Type;
+          PutStreamString(stream, pushValue.StringLiteral);
+        break;
+
+        case PushType_MemberTable:
+          stream += (char)PushType_MemberTable;
+        break;
+
+        //the static member table is just a global lookup with the name of the object's member table
+        case PushType_StaticMemberTable:
+          assert(object != -1 && "static member table push outside of an object");
+          stream += (char)PushType_Global;
+          PutStreamString(stream, string(Table.GetString(Table.ObjectName[object]))+(Table.ObjectType[object] == Object_CData ? "_FFIIndex" : ""));
+        break;
+
+        case PushType_StackSlot:
+        case PushType_StackSlotBase:
+          stream += (char)pushValue.Type;
+          PutStreamULEB(stream, pushValue.StackSlot);
+        break;
+
+        default:
+          assert(false && "unknown push type");
+        break;
+      }
+    }
+
+    funcs << "  {&" << name << ", &" << Table.GetString(Table.TraceRecorder[func]) << ", " << Table.GetString(Table.RecordOptions[func]) << ", "
+          << (requiredFlag != 0 ? Table.GetString(requiredFlag) : "0") << "},\n";
+    count++;
+  }
+
+  return count;
+}
+
+//write a stream as a string literal, the pieces are kept short because MSVC has a limit on the length of each one
+void LibRegBuilder::WriteStreamLiteral(const string& arrayName, const string& stream){
+
+  output << "static const char " << arrayName << "[] =\n  \"";
+
+  size_t lineLength = 0;
+
+  for(char c : stream){
+    if(lineLength >= 100){
+      output << "\"\n  \"";
+      lineLength = 0;
+    }
+
+    //always 3 octal digits so a digit after it isn't read as part of the escape, ? could start a trigraph
+    if(c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?'){
+      output << c;
+      lineLength++;
+    }else{
+      unsigned char value = (unsigned char)c;
+      output << '\\' << (char)('0'+(value >> 6)) << (char)('0'+((value >> 3) & 7)) << (char)('0'+(value & 7));
+      lineLength += 4;
+    }
+  }
+
+  output << "\";\n\n";
+}
+
+void LibRegBuilder::WriteLibRegStream(const std::vector<string>& includeList){
+
+  WriteFileStart(includeList, true);
+
+  output << "#include <string.h>\n\n";
+  output << "enum LibStreamPush{\n";
+  output << "  LibStreamPush_String = " << PushType_String << ",\n";
+  output << "  LibStreamPush_StackSlot = " << PushType_StackSlot << ",\n";
+  output << "  LibStreamPush_StackSlotBase = " << PushType_StackSlotBase << ",\n";
+  output << "  LibStreamPush_MemberTable = " << PushType_MemberTable << ",\n";
+  output << "  LibStreamPush_MT = " << PushType_MT << ",\n";
+  output << "  LibStreamPush_Global = " << PushType_Global << ",\n";
+  output << "};\n\n";
+
+  output << "enum LibStreamFlags{\n";
+  output << "  LibStream_MemberTable = " << LibStream_MemberTable << ",\n";
+  output << "  LibStream_MetaTable = " << LibStream_MetaTable << ",\n";
+  output << "  LibStream_CData = " << LibStream_CData << ",\n";
+  output << "};\n\n";
+
+  output << StreamLoader;
+
+  std::ostringstream funcs;
+  size_t funcCount = 0;
+  std::vector<string> streams(Table.GetObjectCount());
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+
+    string objectName = Table.GetString(Table.ObjectName[object]);
+    bool isCData = Table.ObjectType[object] == Object_CData;
+    auto memberList = Table.GetMemberFunctions(object), metaList = Table.GetMetaFunctions(object);
+    int flags = isCData ? LibStream_CData : 0;
+
+    if(Table.ObjectFlag[object] & ObjectFlag_NeedsMemberTable){
+      flags |= LibStream_MemberTable;
+    }
+
+    if(metaList.size() != 0){
+      flags |= LibStream_MetaTable;
+    }
+
+    string& stream = streams[object];
+    stream += (char)flags;
+    PutStreamULEB(stream, (uint32_t)funcCount);
+    PutStreamULEB(stream, (uint32_t)Table.CountValid(memberList));
+    PutStreamULEB(stream, (uint32_t)Table.CountValid(metaList));
+    PutStreamString(stream, isCData ? objectName+"_FFIIndex" : objectName);
+    PutStreamString(stream, isCData ? objectName+"MT" : objectName);
+
+    funcCount += WriteStreamFunctions(stream, memberList, object, funcs);
+    funcCount += WriteStreamFunctions(stream, metaList, object, funcs);
+  }
+
+  string globalStream;
+  size_t globalStart = funcCount;
+
+  funcCount += WriteStreamFunctions(globalStream, Table.GlobalFunctions, -1, funcs);
+
+  //keeps the array from being empty
+  output << "static const LibStreamFunc LibStreamFuncs[] = {\n" << funcs.str() << "  {NULL, NULL, 0, 0},\n};\n\n";
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+
+    const char* objectName = Table.GetString(Table.ObjectName[object]);
+
+    WriteStreamLiteral(string("LibStream_")+objectName, streams[object]);
+
+    WriteRegObjectFunctionStart(objectName);
+    output << "  LoadLibObject(L, options, (const uint8_t*)LibStream_" << objectName << ", LibStreamFuncs);\n}\n\n";
+  }
+
+  if(funcCount != globalStart){
+    WriteStreamLiteral("LibStream_Globals", globalStream);
+  }
+
+  string registerGlobals;
+
+  if(funcCount != globalStart){
+    registerGlobals = "LoadLibFunctions(L, options, libTable, 0, (const uint8_t*)LibStream_Globals, &LibStreamFuncs["+std::to_string(globalStart)+"], "+
+                      std::to_string(funcCount-globalStart)+")";
+  }
+
+  WriteRegisterLuaLib(false, registerGlobals);
+}
+
+//The file an object's registration goes in with the split output, the output path with the object's name appended
+//to its stem like lj_libreg_Foo.cpp
+string LibRegBuilder::GetObjectFilePath(ObjectIndex object) const{
+
+  llvm::SmallString<256> path(llvm::sys::path::parent_path(OutputPath));
+  string fileName = llvm::sys::path::stem(OutputPath).str()+"_"+Table.GetString(Table.ObjectName[object])+llvm::sys::path::extension(OutputPath).str();
+
+  llvm::sys::path::append(path, fileName);
+
+  return path.str().str();
+}
+
+void LibRegBuilder::WriteLibRegSplit(const std::vector<string>& includeList){
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+
+    WriteIncludes(includeList);
+    WriteExternList(Table.GetObjectFunctions(object));
+    output << SizedTableHelper;
+
+    WriteObjectStart(object);
+
+    for(FuncIndex func : Table.GetMemberFunctions(object)){
+      WriteFunctionInit(func, "memberTable", true);
+    }
+
+    for(FuncIndex func : Table.GetMetaFunctions(object)){
+      WriteFunctionInit(func, "metaTable", true);
+    }
+
+    WriteObjectEnd(object);
+
+    SplitFiles.push_back(std::make_pair(GetObjectFilePath(object), output.str()));
+    output.str(string());
+  }
+
+  //the main file only needs the globals declared unless the recorder table lists every function
+  WriteIncludes(includeList);
+
+  if(DenseRecorders){
+    WriteExtenList();
+    output << FastFuncTypes;
+  }else{
+    WriteExternList(Table.GlobalFunctions);
+  }
+
+  output << SizedTableHelper;
+
+  for(ObjectIndex object = 0; object != Table.GetObjectCount() ;object++){
+    output << "void Register_" << Table.GetString(Table.ObjectName[object]) << "(lua_State* L, uint32_t options);\n";
+  }
+
+  output << "\n";
+
+  WriteRegisterLuaLib(true);
+}
+
+static WriteResult MergeWriteResult(WriteResult a, WriteResult b){
+  return (a == Write_Failed || b == Write_Failed) ? Write_Failed : std::max(a, b);
+}
+
+//Remove the files in the list of the last split output that aren't part of the new one. They belonged to objects that
+//no longer exist, or every file when the output isn't split anymore, so a build that globs them doesn't compile
+//registration for functions that are gone
+void LibRegBuilder::RemoveStaleSplitFiles(const string& listPath){
+
+  auto oldList = llvm::MemoryBuffer::getFile(listPath);
+
+  if(!oldList){
+    return;
+  }
+
+  llvm::SmallVector<StringRef, 32> oldFiles;
+  (*oldList)->getBuffer().split(oldFiles, '\n', -1, false);
+
+  for(StringRef oldFile : oldFiles){
+    bool stale = std::none_of(SplitFiles.begin(), SplitFiles.end(), [&](const std::pair<string, string>& file){
+      return oldFile == file.first;
+    });
+
+    if(stale){
+      llvm::sys::fs::remove(oldFile);
+    }
+  }
+}
+
+//Write the files of the split output followed by the list of them next to the output file
+WriteResult LibRegBuilder::SaveSplitFiles(){
+
+  //object names that only differ by case would be written to the same file on case insensitive file systems
+  std::map<string, string> lowerPaths;
+
+  for(auto& file : SplitFiles){
+    auto added = lowerPaths.insert(std::make_pair(StringRef(file.first).lower(), file.first));
+
+    if(!added.second){
+      std::cout << "Split output files " << added.first->second << " and " << file.first << " only differ by case\n";
+      return Write_Failed;
+    }
+  }
+
+  WriteResult result = Write_Unchanged;
+  string listPath = OutputPath+".files", fileList;
+
+  for(auto& file : SplitFiles){
+    result = MergeWriteResult(result, WriteFileIfChanged(file.first, file.second));
+    fileList += file.first+"\n";
+  }
+
+  RemoveStaleSplitFiles(listPath);
+
+  return MergeWriteResult(result, WriteFileIfChanged(listPath, fileList));
+}
+
+WriteResult LibRegBuilder::SaveOutput(){
+
+  WriteResult result = Write_Unchanged;
+
+  if(!SplitFiles.empty()){
+    result = SaveSplitFiles();
+
+    if(result == Write_Failed){
+      return result;
+    }
+  }else{
+    //the last run split the output so its files and their list have to go
+    string listPath = OutputPath+".files";
+
+    if(llvm::sys::fs::exists(listPath)){
+      RemoveStaleSplitFiles(listPath);
+      llvm::sys::fs::remove(listPath);
+    }
+  }
+
+  return MergeWriteResult(result, WriteFileIfChanged(OutputPath, output.str()));
 }
\ No newline at end of file
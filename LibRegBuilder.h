@@ -1,31 +1,97 @@
 #pragma once
 
-#include "MacroRecorder.h"
-#include <iostream>
-#include <fstream>
+#include "RecorderTable.h"
+#include "OutputFile.h"
+#include <sstream>
 
 class LibRegBuilder{
 
 public:
-  LibRegBuilder(RecorderCollection* collectedMacros, const std::string& outputPath);
+  LibRegBuilder(const RecorderTable& table, const std::string& outputPath);
 
   ~LibRegBuilder(){}
 
   bool RecordersValid();
 
-  void WriteLibReg(std::vector<std::string>& includeList);
+  //The code is generated into memory, SaveOutput writes it to the output file when it changed
+  void WriteLibReg(const std::vector<std::string>& includeList);
+  //Same registration as WriteLibReg but the functions are described by constant arrays that a single loop in the
+  //generated file registers, instead of a block of Lua API calls per function
+  void WriteLibRegTables(const std::vector<std::string>& includeList);
+  //Serializes the functions of each object and the globals into a compact byte stream in the spirit of LuaJIT's
+  //lj_libdef.h that a small fixed loader in the generated file registers, so the file stays quick to compile and
+  //the registration code the same size however many functions there are
+  void WriteLibRegStream(const std::vector<std::string>& includeList);
+  //Same output as WriteLibReg split into a file per object next to the output file, which only keeps
+  //Register_LuaLib. SaveOutput only replaces the files that changed so an incremental build just recompiles the
+  //objects whose functions changed and the rest of them can be compiled in parallel
+  void WriteLibRegSplit(const std::vector<std::string>& includeList);
+  WriteResult SaveOutput();
+
+  //Register_LuaLib only sets up triggers that run an object's Register_ function the first time a script reads a
+  //missing member from its table or the VM looks up its metatable, instead of registering every object up front
+  void SetLazyObjects(bool lazy){
+    LazyObjects = lazy;
+  }
+
+  //Also write FunctionId indexed tables of the fast functions and their recorders with a lookup from a function's
+  //address to its id, so the trace recorder can find the recorder of a called function without closure metadata
+  void SetDenseRecorders(bool dense){
+    DenseRecorders = dense;
+  }
+
+  //Only used by WriteLibRegTables. The keys of the member and metatables are interned in one batch when the lib is
+  //registered and the functions of each table are ordered by LuaJIT's hash of their key, computed here, so none of
+  //them has to be moved out of another key's main node while the presized tables are filled in
+  void SetPrehashKeys(bool prehash){
+    PrehashKeys = prehash;
+  }
+
+  //Number of keys that share their main node with an earlier key of the same table
+  size_t GetKeyCollisions() const{
+    return KeyCollisions;
+  }
+
   void WriteTableCreate(const std::string& tableName, int size, const std::string& destTable, const std::string& destKey, int arraySize = 0);
   void WriteCDataMtCreate(int size, const std::string& typeId);
 
-  void WriteFunctionInit(RecordEntry& entry, const char* outputTable, int subNameStart);
-  void WriteExtenList(std::vector<RecordEntry*>& functionList);
-  void WriteRecorderArray(std::vector<RecordEntry*>& functionList);
+  void WriteFunctionInit(FuncIndex func, const char* outputTable, bool isMember);
+  void WriteExtenList();
+  void WriteRecorderArray();
+
+  void WriteRegObjectFunctionStart(const char* objectName);
+
+private:
+  void WriteIncludes(const std::vector<std::string>& includeList);
+  void WriteFileStart(const std::vector<std::string>& includeList, bool useTables);
+  void WriteExternList(llvm::ArrayRef<FuncIndex> functions);
+  void WriteObjectStart(ObjectIndex object);
+  void WriteObjectEnd(ObjectIndex object);
+  void WriteRegisterLuaLib(bool unrolled, const std::string& registerGlobals = std::string());
+
+  void WriteUpvalues(llvm::ArrayRef<FuncIndex> functions, int object, std::vector<uint32_t>& upvalueStart, uint32_t& upvalueCount);
+  std::vector<FuncIndex> OrderByMainNode(llvm::ArrayRef<FuncIndex> functions);
+  uint32_t GetKeyId(const char* key);
+  std::string GetObjectFilePath(ObjectIndex object) const;
+  WriteResult SaveSplitFiles();
+  void RemoveStaleSplitFiles(const std::string& listPath);
 
-  void WriteRegObjectFunctionStart(const std::string& objectName);
+  size_t WriteStreamFunctions(std::string& stream, llvm::ArrayRef<FuncIndex> functions, int object, std::ostringstream& funcs);
+  void WriteStreamLiteral(const std::string& arrayName, const std::string& stream);
+  size_t WriteFunctionTable(const std::string& arrayName, llvm::ArrayRef<FuncIndex> functions, bool isMember, 
+                            const std::vector<uint32_t>& upvalueStart);
 
 private:
-  RecorderCollection* CollectedMacros;
-  ObjectRecorderData* CurrentObject;
-  std::ofstream output;
+  const RecorderTable& Table;
+  ObjectIndex CurrentObject;
+  bool LazyObjects, DenseRecorders, PrehashKeys;
+  //keys interned by Register_LuaLib, a KeyId is the index into KeyNames plus one
+  llvm::StringMap<uint32_t> KeyIds;
+  std::vector<const char*> KeyNames;
+  size_t KeyCollisions;
+  std::string OutputPath;
+  std::ostringstream output;
+  //path and contents of each file of the split output
+  std::vector<std::pair<std::string, std::string>> SplitFiles;
 };
 
@@ -0,0 +1,56 @@
+#include "LuaStringHash.h"
+
+static uint32_t GetU32(const char* p){
+  const unsigned char* bytes = (const unsigned char*)p;
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static uint32_t Rol(uint32_t value, int shift){
+  return (value << shift) | (value >> (32-shift));
+}
+
+uint32_t LuaStringHash(llvm::StringRef str){
+
+  const char* s = str.data();
+  uint32_t len = (uint32_t)str.size();
+  uint32_t h = len, a, b;
+
+  if(len >= 4){
+    a = GetU32(s);
+    h ^= GetU32(s+len-4);
+    b = GetU32(s+(len>>1)-2);
+    h ^= b;
+    h -= Rol(b, 14);
+    b += GetU32(s+(len>>2)-1);
+  }else if(len > 0){
+    a = (unsigned char)s[0];
+    h ^= (unsigned char)s[len-1];
+    b = (unsigned char)s[len>>1];
+    h ^= b;
+    h -= Rol(b, 14);
+  }else{
+    return 0;
+  }
+
+  a ^= h; a -= Rol(h, 11);
+  b ^= a; b -= Rol(a, 25);
+  h ^= b; h -= Rol(b, 16);
+
+  return h;
+}
+
+uint32_t LuaHashPartSize(uint32_t nrec){
+
+  if(nrec == 0){
+    return 0;
+  }
+
+  //lj_tab_new_ah never makes a hash part with less than 2 nodes
+  uint32_t size = 2;
+
+  while(size < nrec){
+    size *= 2;
+  }
+
+  return size;
+}
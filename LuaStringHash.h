@@ -0,0 +1,11 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+
+//The hash LuaJIT's lj_str_new gives a string. Words are read little endian like on the x86 targets the VM is built for
+uint32_t LuaStringHash(llvm::StringRef str);
+
+//Number of nodes in the hash part of a table created by lua_createtable with nrec hash slots, always a power of two
+uint32_t LuaHashPartSize(uint32_t nrec);
@@ -3,16 +3,18 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Sema/Sema.h"
 #include "clang/Lex/MacroArgs.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
 
+#include <cstdint>
 #include <iostream>
-#include <sstream> 
 
 using std::string;
 using std::pair;
 using namespace clang;
 
 const char LJLib[] = "LJFF_";
-int LJLib_int = *reinterpret_cast<const int*>(&LJLib);
 
 
 class ParseException : std::exception{
@@ -25,26 +27,75 @@ public:
   const SourceLocation Location;
 };
 
-MacroRecorder::MacroRecorder(clang::CompilerInstance& ci, RecorderCollection* collector, bool verbose) : 
-      CI(&ci), SM(&ci.getSourceManager()), Collector(collector), Verbose(verbose) {
+MacroRecorder::MacroRecorder(clang::CompilerInstance& ci, RecorderCollection* collector, bool verbose, const DirectiveState* initialState) : 
+      CI(&ci), SM(&ci.getSourceManager()), Collector(collector), Verbose(verbose), Trace(NULL), DirectiveTime(0),
+      SkippedExpansions(0), HandledExpansions(0), ArgBegin(NULL), ArgToken(NULL), ArgEnd(NULL) {
    
+  if(initialState != NULL){
+    State = *initialState;
+  }
+
+  //mark the keyword macros up front so MacroExpands can reject every other macro with just a pointer compare, this
+  //works the same whether they're defined in a source, a system header or a precompiled prefix
+  MarkKeywordMacros(ci.getPreprocessor());
+
   collector->SetCompilerInstance(ci);
-  functionEntry = new RecordEntry();
-  SetupKeywords();
+  functionEntry = collector->GetArena().NewRecord();
+}
+
+//Point the token cursor at the arguments the preprocessor already lexed for the expansion. They're stored
+//one after another with each argument ended by an eof token
+void MacroRecorder::SetDirectiveArgs(const clang::MacroArgs* args, SourceLocation end){
+
+  EndToken.startToken();
+  EndToken.setKind(tok::eof);
+  EndToken.setLocation(end);
+
+  if(args != NULL && args->getNumArguments() != 0){
+    ArgBegin = ArgToken = args->getUnexpArgument(0);
+    //getNumArguments is the number of tokens in all the arguments including the eof ending each one
+    ArgEnd = ArgToken+args->getNumArguments();
+  }else{
+    ArgBegin = ArgToken = ArgEnd = NULL;
+  }
 }
 
-string MacroRecorder::GetMacroArgs(const clang::Token &macroNameTok, SourceRange& Range){
+//Move to the next token of the directive, returns true if it was the last one before the end of the directive.
+//The eof token ending an argument is where the preprocessor split on a comma so its turned back into one
+bool MacroRecorder::LexDirective(){
+
+  if(ArgToken == ArgEnd){
+    tok = EndToken;
+    return true;
+  }
 
-  int nameLength = macroNameTok.getIdentifierInfo()->getLength();
-  int start = SM->getFileOffset(Range.getBegin())+nameLength+1;
-  int end = SM->getFileOffset(Range.getEnd());
+  tok = *ArgToken++;
 
-  const char* macroStart = SM->getCharacterData(Range.getBegin())+nameLength+1;
+  if(ArgToken == ArgEnd){
+    //keep the location of the closing paren for errors at the end of the directive
+    tok = EndToken;
+    return true;
+  }
 
-  return string(macroStart, end-start);
+  if(tok.is(tok::eof)){
+    tok.setKind(tok::comma);
+  }
+
+  return ArgToken+1 == ArgEnd;
 }
 
-llvm::StringMap<int> MacroRecorder::KeywordLookup;
+//The text of the directive between its parens straight from the source buffer
+StringRef MacroRecorder::GetDirectiveText(){
+
+  if(ArgBegin == ArgEnd || ArgBegin->is(tok::eof)){
+    return StringRef();
+  }
+
+  const char* start = SM->getCharacterData(ArgBegin->getLocation());
+  const char* end = SM->getCharacterData(EndToken.getLocation());
+
+  return StringRef(start, end-start);
+}
 
 #define LJ_KEYWORDS(_) \
   _(ALIAS,        Parse_StackAlias) \
@@ -56,76 +107,88 @@ llvm::StringMap<int> MacroRecorder::KeywordLookup;
   _(REC_GETFIELD, Parse_Record_GetSetField) \
   _(REC_SETFIELD, Parse_Record_GetSetField) \
 
-#define KEYWORD_ENUM(keyword, handler) KW_##keyword,
-
-enum KeywordIds{
- KW_Invalid = 0,
- LJ_KEYWORDS(KEYWORD_ENUM)
-};
+//FNV-1a hash thats constexpr so the case labels of the keyword switch are computed at compile time. Two keywords
+//with the same hash would be duplicate case labels so the compiler checks the hash is perfect for LJ_KEYWORDS
+static constexpr uint32_t KeywordHash(const char* keyword, size_t length, uint32_t hash = 2166136261u){
+  return length == 0 ? hash : KeywordHash(keyword+1, length-1, (uint32_t)(((uint64_t)(hash ^ (uint8_t)*keyword)*16777619u) & 0xffffffffu));
+}
 
-#define KEYWORD_Lookup(keyword, handler) KeywordLookup[#keyword] = KW_##keyword;
+//a name can still hash to a keyword it isn't so the name is always compared as well
+#define KEYWORD_SWITCH(keyword, handler) case KeywordHash(#keyword, sizeof(#keyword)-1): \
+  if(CurrentKeyword == #keyword){ \
+    handler(); \
+    return; \
+  } \
+  break; \
 
-void MacroRecorder::SetupKeywords(){
-  
-  if(!KeywordLookup.empty()){
-    return;
-  }
+#define KEYWORD_MARK(keyword, handler) DirectiveMacros.insert(pp.getIdentifierInfo("LJFF_" #keyword));
 
-  LJ_KEYWORDS(KEYWORD_Lookup);
+//IdentifierInfos are unique per name so marking them up front also works for macros a PCH will define later
+void MacroRecorder::MarkKeywordMacros(clang::Preprocessor& pp){
+  LJ_KEYWORDS(KEYWORD_MARK)
 }
 
-#define KEYWORD_SWITCH(keyword, handler) case KW_##keyword: \
-  handler(); \
-  break; \
-
 void MacroRecorder::MacroExpands(const clang::Token &macroNameTok, const clang::MacroDefinition &MD, SourceRange range, const clang::MacroArgs *Args) {
 
-  StringRef name = macroNameTok.getIdentifierInfo()->getName();
+  //almost every expansion is from the CRT, windows.h or the project's own macros so this has to stay cheap
+  if(!DirectiveMacros.count(macroNameTok.getIdentifierInfo())){
+    SkippedExpansions++;
+    return;
+  }
 
-  if(name.size() < 5 || *((int*)name.data()) != LJLib_int){
+  //lj_ff.h can be found through a system include path but a directive expanded in a system header is never meant for us
+  if(SM->isInSystemHeader(range.getBegin())){
+    SkippedExpansions++;
     return;
   }
+
+  HandledExpansions++;
+
+  StringRef name = macroNameTok.getIdentifierInfo()->getName();
+  TimeTraceAccumulator timer(Trace, DirectiveTime);
   
   MacroLocation = range;
   EndOfMacro = false;
 
-  MacroArgs = GetMacroArgs(macroNameTok, range);
+  Collector->AnnotatedFiles.insert(SM->getFileID(SM->getExpansionLoc(range.getBegin())));
 
-// Args->getUnexpArgument();
+  //parse the tokens the preprocessor lexed for the arguments instead of lexing a copy of their text again
+  SetDirectiveArgs(Args, range.getEnd());
 
-   // Args->
+  CurrentKeyword = name.substr(sizeof(LJLib)-1);
 
-  clang::Lexer lexer(range.getBegin().getLocWithOffset(name.size()+1),
-                     CI->getLangOpts(),
-                     MacroArgs.c_str(), MacroArgs.c_str(), MacroArgs.c_str()+MacroArgs.size());
-  
-  MacroLexer = &lexer;
+  switch(KeywordHash(CurrentKeyword.data(), CurrentKeyword.size())){
+    LJ_KEYWORDS(KEYWORD_SWITCH)
+  }
 
-  int lineNumber = GetStartingLineNumber();
+  assert(false && "Unknown keyword");
+}
 
-  CurrentKeyword = name.substr(strlen("LJFF_"));
+//Track every file that gets entered so the ResultCache knows what files the collected records depend on
+void MacroRecorder::FileChanged(SourceLocation loc, FileChangeReason reason, SrcMgr::CharacteristicKind fileType, FileID prevFID){
 
-  int keyword = KeywordLookup[CurrentKeyword];
+  if(reason != EnterFile){
+    return;
+  }
 
-  switch (keyword){
-    LJ_KEYWORDS(KEYWORD_SWITCH)
-
-    default:
-      assert(false && "Unknown keyword");
-      break;
+  const FileEntry* file = SM->getFileEntryForID(SM->getFileID(SM->getExpansionLoc(loc)));
+
+  //the predefines buffer has no file entry
+  if(file != NULL){
+    Collector->FileIncluded(file->getName());
   }
 }
 
 void MacroRecorder::Parse_Module(){
 
-  if(!LexExpect(tok::raw_identifier)){
+  if(!LexExpectIdentifier()){
     SetCurrentEntryInvalid("expected name of module");
     return;
   }
 
   string name = TokenToStringRef(tok);
 
-  if(!LexExpect(tok::comma, tok::raw_identifier)){
+  if(!LexExpect(tok::comma) || !LexExpectIdentifier()){
     SetCurrentEntryInvalid("expected module type");
     return;
   }
@@ -138,7 +201,7 @@ void MacroRecorder::Parse_Module(){
 
 void MacroRecorder::Parse_NeedsFlag(){
 
-  if(!LexExpectEnd(tok::raw_identifier)){
+  if(!LexExpectIdentifierEnd()){
     SetCurrentEntryInvalid("expected a name of an enum entry");
     return;
   }
@@ -148,20 +211,22 @@ void MacroRecorder::Parse_NeedsFlag(){
 
 void MacroRecorder::Parse_NoExtern(){
 
-  if(!LexExpectEnd(tok::raw_identifier)){
+  if(!LexExpectIdentifierEnd()){
     SetCurrentEntryInvalid("expected a name of a function for NOEXTERN");
     return;
   }
 
-  NoExtern.insert(TokenToStringRef(tok));
+  State.NoExtern.insert(TokenToStringRef(tok));
 }
 
-StringRef MacroRecorder::TokenToStringRef(Token& tok){
-   
-  switch(tok.getKind()){
-    case tok::raw_identifier:
-      return tok.getRawIdentifier();
+StringRef MacroRecorder::TokenToStringRef(const Token& tok){
 
+  //the preprocessor has already looked up identifiers and keywords
+  if(IsIdentifier(tok)){
+    return tok.getIdentifierInfo()->getName();
+  }
+
+  switch(tok.getKind()){
     case tok::numeric_constant:
       return StringRef(tok.getLiteralData(), tok.getLength());
     
@@ -183,11 +248,11 @@ StringRef MacroRecorder::TokenToStringRef(Token& tok){
 */
 bool MacroRecorder::ParsePushValue(PushEntry& result){
 
-  MacroLexer->LexFromRawLexer(tok);
+  LexDirective();
   
   if(tok.is(tok::string_literal)){
-   result = PushEntry(TokenToStringRef(tok));
-  }else if(tok.is(tok::raw_identifier)){
+   result = PushEntry(Collector->GetArena().SaveString(TokenToStringRef(tok)));
+  }else if(IsIdentifier(tok)){
     StringRef identifer = TokenToStringRef(tok);
 
     bool isTop = identifer == "top";
@@ -205,7 +270,11 @@ bool MacroRecorder::ParsePushValue(PushEntry& result){
       }
 
       int offset;
-      assert(!TokenToStringRef(tok).getAsInteger(10, offset));
+
+      if(TokenToStringRef(tok).getAsInteger(10, offset)){
+        SetCurrentEntryInvalid("expected number for a stack offset");
+       return false;
+      }
 
       result = PushEntry(isTop ? PushType_StackSlot : PushType_StackSlotBase, offset);
 
@@ -218,22 +287,27 @@ bool MacroRecorder::ParsePushValue(PushEntry& result){
       bool mt = identifer == "MT";
       result = PushEntry(mt ? PushType_MT : PushType_Global);
            
-      if(!LexExpect(tok::comma) || !LexExpectEnd(tok::raw_identifier)){
+      if(!LexExpect(tok::comma) || !LexExpectIdentifierEnd()){
         SetCurrentEntryInvalid("Expected %s table name");
        return false;
       }
 
-      result.StringLiteral = new std::string(TokenToStringRef(tok));
+      result.StringLiteral = Collector->GetArena().SaveString(TokenToStringRef(tok));
     }else{
 
-      auto alias = StackAlias.find(identifer);
+      auto alias = State.StackAlias.find(identifer);
 
-      if(alias == StackAlias.end()){
+      if(alias == State.StackAlias.end()){
         SetCurrentEntryInvalid("Unknown stack alias %s");
        return false;
       }
 
       result = alias->second;
+
+      //aliases from a prefix header keep their strings in the prefix's arena
+      if(result.HasString()){
+        result.StringLiteral = Collector->GetArena().SaveString(result.StringLiteral);
+      }
     }
   }else{
     SetCurrentEntryInvalid("Unknown push type ");
@@ -246,10 +320,10 @@ bool MacroRecorder::ParsePushValue(PushEntry& result){
 void MacroRecorder::Parse_StackAlias(){
 
   if(Verbose){
-    std::cout << GetStartingLineNumber() << ": StackAlias " << MacroArgs  << "\n";
+    std::cout << GetStartingLineNumber() << ": StackAlias " << GetDirectiveText().str() << "\n";
   }
 
-  if(!LexExpect(tok::raw_identifier)){
+  if(!LexExpectIdentifier()){
     SetCurrentEntryInvalid("Expected name for stack alias");
    return;
   }
@@ -264,7 +338,7 @@ void MacroRecorder::Parse_StackAlias(){
   PushEntry entry;
 
   if(ParsePushValue(entry)){
-    StackAlias[aliasName] = entry;
+    State.StackAlias[aliasName] = entry;
   }
 
 }
@@ -273,7 +347,7 @@ void MacroRecorder::Parse_Push(){
   PushEntry entry;
 
   if(Verbose){
-    std::cout << GetStartingLineNumber() << ": Push " << MacroArgs  << "\n";
+    std::cout << GetStartingLineNumber() << ": Push " << GetDirectiveText().str() << "\n";
   }
 
   if(ParsePushValue(entry)){
@@ -288,7 +362,7 @@ void MacroRecorder::Parse_Push(){
 void MacroRecorder::Parse_Record_GetSetField(){
   
   if(Verbose){
-    std::cout << GetStartingLineNumber() << ": Record(" << CurrentKeyword.str() << "):" << "  " << MacroArgs  << "\n\n";
+    std::cout << GetStartingLineNumber() << ": Record(" << CurrentKeyword.str() << "):" << "  " << GetDirectiveText().str() << "\n\n";
   }
 
   bool isSet = CurrentKeyword == "REC_SETFIELD";
@@ -296,7 +370,7 @@ void MacroRecorder::Parse_Record_GetSetField(){
   functionEntry->RecordLineNumber = GetStartingLineNumber();
   functionEntry->Type = isSet ? Recorder_SetField: Recorder_GetField;
   
-  if(!LexExpect(tok::raw_identifier)){
+  if(!LexExpectIdentifier()){
     SetCurrentEntryInvalid("Expected object type name or field name for SetField/ReturnField definition");
    return;
   }
@@ -314,7 +388,7 @@ void MacroRecorder::Parse_Record_GetSetField(){
 
   functionEntry->TraceRecorder = (isSet ? "SetObjectField" : "GetObjectField") +TokenToStringRef(tok).str()+", ";
 
-  if(!LexExpect(tok::comma) || !LexExpect(tok::raw_identifier)){
+  if(!LexExpect(tok::comma) || !LexExpectIdentifier()){
     SetCurrentEntryInvalid("Invalid or missing field type for SetField/ReturnField definition");
    return;
   }
@@ -322,13 +396,13 @@ void MacroRecorder::Parse_Record_GetSetField(){
   //field type
   auto templateDef = TokenToStringRef(tok).str()+"|(";
 
-  if(!LexExpect(tok::comma) || !MacroLexer->LexFromRawLexer(tok)){
+  if(!LexExpect(tok::comma) || !LexDirective()){
     SetCurrentEntryInvalid("Invalid or missing field offset for SetField/ReturnField definition");
    return;
   }
   
   //field offset
-  if(tok.is(tok::raw_identifier) || tok.is(tok::numeric_constant)){
+  if(IsIdentifier(tok) || tok.is(tok::numeric_constant)){
     templateDef += TokenToStringRef(tok).str();
   }else{
     SetCurrentEntryInvalid("unknown field offset value type for SetField/ReturnField definition");
@@ -348,8 +422,6 @@ bool MacroRecorder::SkipToNextToken(clang::tok::TokenKind endToken){
 
   int ParenCount = 0, BraceCount = 0, BracketCount = 0;
 
-  SourceLocation loc = MacroLexer->getSourceLocation();
-  
   while(tok.isNot(tok::eof)){
 
     if(tok.is(endToken) && ParenCount == 0 && BraceCount == 0 && BracketCount == 0){
@@ -395,7 +467,7 @@ bool MacroRecorder::SkipToNextToken(clang::tok::TokenKind endToken){
       break;
     }
 
-    MacroLexer->LexFromRawLexer(tok);
+    LexDirective();
   }
 
   if(ParenCount == 0 && BraceCount == 0 && BracketCount == 0){
@@ -406,10 +478,11 @@ bool MacroRecorder::SkipToNextToken(clang::tok::TokenKind endToken){
   }
 }
 
-bool MacroRecorder::ParseRecordArgParam(std::string& result){
+//The text of the parameter is taken straight from the source buffer
+bool MacroRecorder::ParseRecordArgParam(StringRef& result){
 
   if(tok.is(tok::comma)){
-    MacroLexer->LexFromRawLexer(tok);
+    LexDirective();
   }
 
   const char* paramStart = SM->getCharacterData(tok.getLocation());
@@ -422,7 +495,7 @@ bool MacroRecorder::ParseRecordArgParam(std::string& result){
 
   const char* paramEnd = SM->getCharacterData(tok.getLocation());
 
-  result = string(paramStart, paramEnd);
+  result = StringRef(paramStart, paramEnd-paramStart);
 
   return true;
 }
@@ -438,7 +511,7 @@ void MacroRecorder::Parse_Record(){
   
   functionEntry->RecordLineNumber = GetStartingLineNumber();
 
-  MacroLexer->LexFromRawLexer(tok);
+  LexDirective();
 
   if(tok.is(tok::period)){
     //a dot means we automatically calculate the name as  recff_ + the name of the function
@@ -451,17 +524,17 @@ void MacroRecorder::Parse_Record(){
       functionEntry->TraceRecorder  = ".";
     }
 
-  }else if(tok.is(tok::raw_identifier)){
+  }else if(IsIdentifier(tok)){
     //a named recorder was specified 
     functionEntry->TraceRecorder = "recff_"+TokenToStringRef(tok).str();
 
-    MacroLexer->LexFromRawLexer(tok);
+    LexDirective();
 
     if(tok.is(tok::eof)){
       functionEntry->RecordOptions = "0";
     }else{
       //record options were specified so try to parse them
-      string optionParam;
+      StringRef optionParam;
       
       if(!ParseRecordArgParam(optionParam)){
         return;
@@ -469,10 +542,10 @@ void MacroRecorder::Parse_Record(){
 
       if(tok.is(tok::eof)){
         //just a single recorder option was specified
-        functionEntry->RecordOptions = optionParam;
+        functionEntry->RecordOptions = optionParam.str();
       }else{
         //more than one record option parse upto 3 more
-        std::vector<string> options;
+        llvm::SmallVector<StringRef, 4> options;
         options.push_back(optionParam);
 
         while(tok.isNot(tok::eof)){
@@ -485,9 +558,8 @@ void MacroRecorder::Parse_Record(){
           return;
         }
 
-        auto it = options.begin();
-
-        std::stringstream buff;
+        functionEntry->RecordOptions.clear();
+        llvm::raw_string_ostream buff(functionEntry->RecordOptions);
 
         if(options.size() == 2){
           //pack 2 options both need tobe smaller than MAX uint16_t
@@ -495,40 +567,34 @@ void MacroRecorder::Parse_Record(){
         }else{
 
           for(int i = options.size()-2; i != 0 ;--i){
-            buff << '((' << options[i] << ") <<" << (i*4) << ')|';
+            buff << "((" << options[i] << ") <<" << (i*4) << ")|";
           }
         }
 
         //write the first option in the lower bits is either 
         buff << '(' << options[0] << ')';
-
-        functionEntry->RecordOptions = buff.str();
+        buff.flush();
       }
     }
   }else if(tok.is(tok::amp)){
     //a c++ template based recorder was specified in the form of an & address of operator followed by the template instigation
     //LJLIB_REC(&ReturnField<Model, Vec3, ModelOffset_BoundingBox>)
-    MacroLexer->LexFromRawLexer(tok);
-    const char* loc = MacroLexer->getBufferLocation();
+    LexDirective();
 
-    if(tok.isNot(tok::raw_identifier)){
+    if(!IsIdentifier(tok)){
       SetCurrentEntryInvalid("Expected a template function name");
       return;
     }
 
-    MacroLexer->LexFromRawLexer(tok);
-    const char* name = tok.getName();
-
-    MacroLexer->LexFromRawLexer(tok);
+    LexDirective();
+    LexDirective();
 
   }else{
-    const char* name = tok.getName();
-
     SetCurrentEntryInvalid("Unrecognized record info");
     return;
   }
 
-  if(NoExtern.find(functionEntry->TraceRecorder) != NoExtern.end()){
+  if(State.NoExtern.find(functionEntry->TraceRecorder) != State.NoExtern.end()){
     functionEntry->NoRecorderExtern = true;
   }
 
@@ -537,7 +603,7 @@ void MacroRecorder::Parse_Record(){
 
 void MacroRecorder::FinalizeRecorder(){
   Collector->RecorderFinalized(functionEntry);
-  functionEntry = new RecordEntry();
+  functionEntry = Collector->GetArena().NewRecord();
 }
 
 void MacroRecorder::SetCurrentEntryInvalid(const char* reason, StringRef fmtarg){
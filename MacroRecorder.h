@@ -1,10 +1,12 @@
 #pragma once
 
 #include "clang/Lex/PPCallbacks.h"
-#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Token.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/StringSet.h"
 
 #include "RecorderCollection.h"
+#include "TimeTrace.h"
 
 #include <map>
 #include <memory>
@@ -18,6 +20,9 @@ namespace clang{
   class Lexer;
   class Token;
   class FunctionDecl;
+  class MacroArgs;
+  class Preprocessor;
+  class IdentifierInfo;
 
   namespace tok {
     enum TokenKind : unsigned short;
@@ -25,11 +30,42 @@ namespace clang{
 };
 
 
+//Directive state that carries over from one LJFF_ directive to the next. The state left after parsing a
+//precompiled prefix header is handed to the recorder of every source file that uses it. The strings of the
+//aliases are owned by the RecordArena of whoever holds the state
+struct DirectiveState{
+  llvm::StringMap<PushEntry> StackAlias;
+  llvm::StringSet<> NoExtern;
+};
+
 class MacroRecorder : public clang::PPCallbacks {
 public:
-  explicit MacroRecorder(clang::CompilerInstance& ci, RecorderCollection* collector, bool verbose);
+  explicit MacroRecorder(clang::CompilerInstance& ci, RecorderCollection* collector, bool verbose, const DirectiveState* initialState = NULL);
+
+  const DirectiveState& GetDirectiveState() const{
+    return State;
+  }
+
+  //Add up the time spent handling LJFF_ directives for -time-trace
+  void SetTimeTrace(const TimeTrace* trace){
+    Trace = trace;
+  }
+
+  uint64_t GetDirectiveTime() const{
+    return DirectiveTime;
+  }
+
+  //Number of macro expansions rejected before doing any work because they weren't one of our directives
+  unsigned GetSkippedExpansions() const{
+    return SkippedExpansions;
+  }
+
+  unsigned GetHandledExpansions() const{
+    return HandledExpansions;
+  }
 
   void MacroExpands(const clang::Token &MacroNameTok, const clang::MacroDefinition &MD, clang::SourceRange Range, const clang::MacroArgs *Args) override;
+  void FileChanged(clang::SourceLocation Loc, FileChangeReason Reason, clang::SrcMgr::CharacteristicKind FileType, clang::FileID PrevFID) override;
 
 private:
   void Parse_StackAlias();
@@ -39,14 +75,23 @@ private:
   void Parse_NeedsFlag();
   void Parse_NoExtern();
   void Parse_Module();
+
+  void MarkKeywordMacros(clang::Preprocessor& pp);
   
   bool ParsePushValue(PushEntry& result);
   bool SkipToNextToken(clang::tok::TokenKind endToken);
   
-  std::string GetMacroArgs(const clang::Token &macroNameTok, clang::SourceRange& Range);
-  bool ParseRecordArgParam(std::string& option);
+  void SetDirectiveArgs(const clang::MacroArgs* args, clang::SourceLocation end);
+  bool LexDirective();
+  llvm::StringRef GetDirectiveText();
+  bool ParseRecordArgParam(llvm::StringRef& option);
 
-  static clang::StringRef TokenToStringRef(clang::Token& tok);
+  static clang::StringRef TokenToStringRef(const clang::Token& tok);
+
+  //keywords are lexed as their own token kinds but are just names to us
+  static bool IsIdentifier(const clang::Token& tok){
+    return tok.getIdentifierInfo() != NULL;
+  }
 
   void FinalizeRecorder();
   void SetCurrentEntryInvalid(const char* reason, StringRef fmarg = "");
@@ -57,10 +102,24 @@ private:
       return false;
     }
     
-    EndOfMacro = MacroLexer->LexFromRawLexer(tok);
+    EndOfMacro = LexDirective();
     return tok.is(token);
   }
 
+  bool LexExpectIdentifier(){
+
+    if(EndOfMacro){
+      return false;
+    }
+
+    EndOfMacro = LexDirective();
+    return IsIdentifier(tok);
+  }
+
+  bool LexExpectIdentifierEnd(){
+    return LexExpectIdentifier() && EndOfMacro;
+  }
+
   bool LexExpect(clang::tok::TokenKind token1, clang::tok::TokenKind token2){
     return LexExpect(token1) && LexExpect(token2);
   }
@@ -80,24 +139,28 @@ private:
   RecorderCollection* Collector;
 
 private:
-  void SetupKeywords();
-
   bool Verbose;
   RecordEntry* functionEntry;
-  llvm::StringMap<PushEntry> StackAlias;
-  llvm::StringSet<> NoExtern;
+  DirectiveState State;
+
+  const TimeTrace* Trace;
+  uint64_t DirectiveTime;
+
+  //identifiers of the LJFF_ keyword macros, there's only a handful so the set never leaves its inline storage
+  llvm::SmallPtrSet<const clang::IdentifierInfo*, 16> DirectiveMacros;
+  unsigned SkippedExpansions, HandledExpansions;
 
   int CurrentLine;
   llvm::StringRef CurrentKeyword;
-  std::string MacroArgs;
   
   bool EndOfMacro;
-  clang::Lexer* MacroLexer;
+  //the tokens of the directive's arguments owned by the preprocessor, ArgToken is the next one to parse
+  const clang::Token *ArgBegin, *ArgToken, *ArgEnd;
+  //eof at the closing paren of the directive returned once the arguments run out
+  clang::Token EndToken;
   clang::Token tok;
   clang::SourceRange MacroLocation;
 
   clang::SourceManager* SM;
   clang::CompilerInstance* CI;
-
-  static llvm::StringMap<int> KeywordLookup;
 };
@@ -0,0 +1,52 @@
+#include "OutputFile.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+static bool FileHasContents(const std::string& path, llvm::StringRef contents){
+
+  uint64_t fileSize;
+
+  //most changes also change the size so don't bother reading the file when it differs
+  if(llvm::sys::fs::file_size(path, fileSize) || fileSize != contents.size()){
+    return false;
+  }
+
+  auto buffer = llvm::MemoryBuffer::getFile(path, -1, false);
+
+  return buffer && (*buffer)->getBuffer() == contents;
+}
+
+WriteResult WriteFileIfChanged(const std::string& path, llvm::StringRef contents){
+
+  if(FileHasContents(path, contents)){
+    return Write_Unchanged;
+  }
+
+  int fd;
+  llvm::SmallString<256> tempPath;
+
+  if(llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", fd, tempPath)){
+    return Write_Failed;
+  }
+
+  bool failed;
+
+  {
+    llvm::raw_fd_ostream tempFile(fd, true);
+    tempFile << contents;
+    tempFile.close();
+
+    failed = tempFile.has_error();
+    tempFile.clear_error();
+  }
+
+  if(failed || llvm::sys::fs::rename(tempPath, path)){
+    llvm::sys::fs::remove(tempPath);
+    return Write_Failed;
+  }
+
+  return Write_Updated;
+}
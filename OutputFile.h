@@ -0,0 +1,16 @@
+#pragma once
+
+#include "llvm/ADT/StringRef.h"
+
+#include <string>
+
+enum WriteResult{
+  Write_Failed,
+  Write_Unchanged,
+  Write_Updated,
+};
+
+//Replace the file at path with contents unless it already holds exactly the same bytes, so an unchanged output
+//keeps its timestamp and doesn't trigger a rebuild of everything that depends on it. The new contents are written
+//to a temporary file next to it first and renamed over it so readers never see a partly written file
+WriteResult WriteFileIfChanged(const std::string& path, llvm::StringRef contents);
@@ -0,0 +1,392 @@
+#include "PrefixHeader.h"
+#include "RecorderCollection.h"
+#include "ResultCache.h"
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using std::string;
+using llvm::StringRef;
+
+//bump this when the layout of the saved prefix records changes
+static const char PrefixFormat[] = "buildvm_clang-prefix 2";
+
+//clang rejects a PCH when the modification time or size of any file it was built from changed even if the contents
+//are the same, so these are saved with the hashes of the files as well
+static string GetFileStamp(const string& path){
+
+  llvm::sys::fs::file_status status;
+
+  if(llvm::sys::fs::status(path, status)){
+    return string();
+  }
+
+  return std::to_string(status.getLastModificationTime().toEpochTime()) + ' ' + std::to_string(status.getSize());
+}
+
+static string NormalizeDirective(StringRef directive, StringRef name){
+  return ("#" + name + " " + directive.substr(name.size()).trim()).str();
+}
+
+//Collect the #include and #define lines a source file starts with skipping blank lines and comments, stops at
+//the first line that is anything else since the lines after it could depend on it
+static std::vector<string> ReadLeadingDirectives(StringRef sourcePath){
+
+  std::vector<string> directives;
+  auto buffer = llvm::MemoryBuffer::getFile(sourcePath);
+
+  if(!buffer){
+    return directives;
+  }
+
+  StringRef text = (*buffer)->getBuffer();
+  bool inComment = false;
+
+  while(!text.empty()){
+    auto split = text.split('\n');
+    StringRef line = split.first.trim();
+    text = split.second;
+
+    if(inComment){
+      size_t end = line.find("*/");
+
+      if(end == StringRef::npos){
+        continue;
+      }
+
+      inComment = false;
+      line = line.substr(end+2).trim();
+    }
+
+    if(line.startswith("/*")){
+      size_t end = line.find("*/", 2);
+
+      if(end == StringRef::npos){
+        inComment = true;
+        continue;
+      }
+
+      line = line.substr(end+2).trim();
+    }
+
+    if(line.empty() || line.startswith("//")){
+      continue;
+    }
+
+    //multi line macros are not worth handling
+    if(!line.startswith("#") || line.endswith("\\")){
+      break;
+    }
+
+    StringRef directive = line.substr(1).ltrim();
+
+    if(directive.startswith("include")){
+      directives.push_back(NormalizeDirective(directive, "include"));
+    }else if(directive.startswith("define")){
+      directives.push_back(NormalizeDirective(directive, "define"));
+    }else{
+      break;
+    }
+  }
+
+  return directives;
+}
+
+static bool IsCFile(StringRef path){
+  return llvm::sys::path::extension(path).equals_lower(".c");
+}
+
+static string GetSourceDir(StringRef sourcePath){
+  return llvm::sys::path::parent_path(clang::tooling::getAbsolutePath(sourcePath));
+}
+
+PrefixHeader::PrefixHeader() : IsCSource(false), Cache(NULL){
+}
+
+bool PrefixHeader::DetectPrefix(const std::vector<string>& sources){
+
+  Lines.clear();
+
+  bool first = true;
+
+  for(auto& source : sources){
+    std::vector<string> directives = ReadLeadingDirectives(source);
+
+    if(first){
+      Lines = std::move(directives);
+      first = false;
+      continue;
+    }
+
+    auto mismatch = std::mismatch(Lines.begin(), Lines.end(), directives.begin(), directives.end());
+    Lines.erase(mismatch.first, Lines.end());
+  }
+
+  //a trailing #define on its own gains nothing from being precompiled
+  while(!Lines.empty() && !StringRef(Lines.back()).startswith("#include")){
+    Lines.pop_back();
+  }
+
+  return SetUsers(sources);
+}
+
+bool PrefixHeader::SetPrefixIncludes(const std::vector<string>& includes, const std::vector<string>& sources){
+
+  Lines.clear();
+
+  for(auto& include : includes){
+    if(StringRef(include).startswith("<")){
+      Lines.push_back("#include " + include);
+    }else{
+      Lines.push_back("#include \"" + include + "\"");
+    }
+  }
+
+  return SetUsers(sources);
+}
+
+bool PrefixHeader::SetUsers(const std::vector<string>& sources){
+
+  Users.clear();
+
+  if(Lines.empty()){
+    return false;
+  }
+
+  for(auto& source : sources){
+    std::vector<string> directives = ReadLeadingDirectives(source);
+
+    if(directives.size() < Lines.size() || !std::equal(Lines.begin(), Lines.end(), directives.begin())){
+      continue;
+    }
+
+    //the relative includes are resolved against the directory of the first source, and the PCH has to be
+    //built as the same language as the sources using it or its options won't match
+    if(Users.empty()){
+      SourceDir = GetSourceDir(source);
+      IsCSource = IsCFile(source);
+    }else if(GetSourceDir(source) != SourceDir || IsCFile(source) != IsCSource){
+      continue;
+    }
+
+    Users.insert(clang::tooling::getAbsolutePath(source));
+  }
+
+  //building the PCH costs more than it saves when only one source file uses it
+  if(Users.size() < 2){
+    Users.clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool PrefixHeader::CanUseFor(const string& sourcePath) const{
+  return Users.count(clang::tooling::getAbsolutePath(sourcePath)) != 0;
+}
+
+bool PrefixHeader::Prepare(const string& outputDir, const std::vector<string>& commandLine, ResultCache* cache){
+
+  Cache = cache;
+
+  string header;
+
+  for(auto& line : Lines){
+    header += line;
+    header += '\n';
+  }
+
+  //key the files on everything that changes the PCH so different configurations don't overwrite each other
+  llvm::MD5 hash;
+  llvm::MD5::MD5Result result;
+  llvm::SmallString<32> key;
+
+  hash.update(header);
+  hash.update(SourceDir);
+  hash.update(IsCSource ? "c" : "c++");
+
+  //separate the arguments so the same characters split differently don't give the same key
+  for(size_t i = 1; i < commandLine.size() ;i++){
+    hash.update(commandLine[i]);
+    hash.update(StringRef("\0", 1));
+  }
+
+  hash.final(result);
+  llvm::MD5::stringifyResult(result, key);
+
+  llvm::SmallString<256> path(outputDir);
+  llvm::sys::path::append(path, "prefix-" + key.str());
+  llvm::sys::fs::make_absolute(path);
+
+  HeaderPath = (path + ".h").str();
+  PCHPath = (path + ".pch").str();
+  RecordsPath = (path + ".records").str();
+
+  //only rewrite the header when its missing so its timestamp stays the same as the one in the PCH
+  if(!llvm::sys::fs::exists(HeaderPath)){
+    std::ofstream headerFile(HeaderPath, std::ios::binary);
+    headerFile << header;
+  }
+
+  return Cache != NULL && llvm::sys::fs::exists(PCHPath) && LoadSaved();
+}
+
+bool PrefixHeader::LoadSaved(){
+
+  std::ifstream input(RecordsPath, std::ios::binary);
+  string line, path, hash, stamp;
+  size_t count;
+
+  if(!input || !std::getline(input, line) || line != PrefixFormat || !(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  Dependencies.clear();
+
+  //the prefix header is an input of the PCH too
+  if(!std::getline(input, stamp) || GetFileStamp(HeaderPath) != stamp){
+    return false;
+  }
+
+  for(size_t i = 0; i != count ;i++){
+    if(!std::getline(input, path) || !std::getline(input, hash) || !std::getline(input, stamp) ||
+       Cache->GetFileHash(path) != hash || GetFileStamp(path) != stamp){
+      return false;
+    }
+
+    Dependencies.push_back(path);
+  }
+
+  DirectiveState state;
+
+  if(!(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  for(size_t i = 0; i != count ;i++){
+    PushEntry pushValue;
+
+    if(!RecorderCollection::LoadString(input, line) || !RecorderCollection::LoadPushEntry(input, pushValue, Strings)){
+      return false;
+    }
+
+    state.StackAlias[line] = pushValue;
+  }
+
+  if(!(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  for(size_t i = 0; i != count ;i++){
+    if(!RecorderCollection::LoadString(input, line)){
+      return false;
+    }
+
+    state.NoExtern.insert(line);
+  }
+
+  //check the records parse before trusting them
+  std::ostringstream records(std::ios::binary);
+  records << input.rdbuf();
+
+  std::istringstream recordsInput(records.str(), std::ios::binary);
+  RecorderCollection loaded(false);
+
+  if(!loaded.LoadRecords(recordsInput)){
+    return false;
+  }
+
+  Records = records.str();
+  State = std::move(state);
+
+  return true;
+}
+
+std::vector<string> PrefixHeader::GetBuildCommandLine(std::vector<string> commandLine) const{
+
+  //swap the source file for the prefix header, the source directory is added to the quoted include paths so
+  //includes relative to the sources still resolve from the header in the output directory
+  commandLine.pop_back();
+  commandLine.push_back("-iquote");
+  commandLine.push_back(SourceDir);
+  commandLine.push_back("-x");
+  commandLine.push_back(IsCSource ? "c-header" : "c++-header");
+  commandLine.push_back(HeaderPath);
+
+  return commandLine;
+}
+
+void PrefixHeader::SetBuildResult(const RecorderCollection& records, const DirectiveState& state){
+
+  std::ostringstream output(std::ios::binary);
+  records.SaveRecords(output);
+
+  Records = output.str();
+  Dependencies = records.IncludedFiles;
+
+  State = state;
+
+  //the alias strings belong to the arena of the records that built the prefix
+  for(auto& alias : State.StackAlias){
+    PushEntry& pushValue = alias.getValue();
+
+    if(pushValue.HasString()){
+      pushValue.StringLiteral = Strings.SaveString(pushValue.StringLiteral);
+    }
+  }
+}
+
+void PrefixHeader::Save(){
+
+  if(Cache == NULL){
+    return;
+  }
+
+  std::ofstream output(RecordsPath, std::ios::binary);
+
+  output << PrefixFormat << '\n' << Dependencies.size() << '\n';
+  output << GetFileStamp(HeaderPath) << '\n';
+
+  for(auto& path : Dependencies){
+    output << path << '\n' << Cache->GetFileHash(path) << '\n' << GetFileStamp(path) << '\n';
+  }
+
+  output << State.StackAlias.size() << '\n';
+
+  for(auto& alias : State.StackAlias){
+    RecorderCollection::SaveString(output, alias.getKey().str());
+    RecorderCollection::SavePushEntry(output, alias.getValue());
+  }
+
+  output << State.NoExtern.size() << '\n';
+
+  for(auto& name : State.NoExtern){
+    RecorderCollection::SaveString(output, name.getKey().str());
+  }
+
+  output << Records;
+}
+
+void PrefixHeader::RemoveFiles(){
+  llvm::sys::fs::remove(HeaderPath);
+  llvm::sys::fs::remove(PCHPath);
+  llvm::sys::fs::remove(RecordsPath);
+}
+
+void PrefixHeader::ReplayRecords(RecorderCollection& recorders) const{
+
+  std::istringstream input(Records, std::ios::binary);
+  RecorderCollection prefixRecords(false);
+
+  if(prefixRecords.LoadRecords(input)){
+    recorders.MergeShard(prefixRecords);
+  }
+}
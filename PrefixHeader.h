@@ -0,0 +1,74 @@
+#pragma once
+
+#include "MacroRecorder.h"
+#include "llvm/ADT/StringSet.h"
+
+#include <string>
+#include <vector>
+
+class ResultCache;
+
+//A precompiled header built from the #include and #define lines that source files start with, so the headers
+//they share are only parsed once. The LJFF_ directives recorded while building it are replayed into the records
+//of every source file that uses it, the same as if the source file had parsed the headers itself
+class PrefixHeader{
+
+public:
+  PrefixHeader();
+
+  //Use the longest run of leading #include and #define lines shared by the source files
+  bool DetectPrefix(const std::vector<std::string>& sources);
+  //Use a list of headers, only source files that start by including all of them in the same order can use the prefix
+  bool SetPrefixIncludes(const std::vector<std::string>& includes, const std::vector<std::string>& sources);
+
+  bool CanUseFor(const std::string& sourcePath) const;
+
+  //Write the prefix header into outputDir, returns true if a PCH saved by a previous run is still valid
+  bool Prepare(const std::string& outputDir, const std::vector<std::string>& commandLine, ResultCache* cache);
+
+  //Adjust the command line of the first source file that uses the prefix to build the PCH
+  std::vector<std::string> GetBuildCommandLine(std::vector<std::string> commandLine) const;
+
+  //Keep the directives recorded while the PCH was built, Save persists them with the PCH for later runs
+  void SetBuildResult(const RecorderCollection& records, const DirectiveState& state);
+  void Save();
+
+  void ReplayRecords(RecorderCollection& recorders) const;
+
+  //Delete the header and PCH when they were only built for a single run
+  void RemoveFiles();
+
+  const DirectiveState& GetDirectiveState() const{
+    return State;
+  }
+
+  const std::string& GetHeaderPath() const{
+    return HeaderPath;
+  }
+
+  const std::string& GetPCHPath() const{
+    return PCHPath;
+  }
+
+  const std::vector<std::string>& GetLines() const{
+    return Lines;
+  }
+
+private:
+  bool SetUsers(const std::vector<std::string>& sources);
+  bool LoadSaved();
+
+  std::vector<std::string> Lines;
+  std::string SourceDir;
+  bool IsCSource;
+  llvm::StringSet<> Users;
+
+  std::string HeaderPath, PCHPath, RecordsPath;
+  ResultCache* Cache;
+
+  std::vector<std::string> Dependencies;
+  std::string Records;
+  DirectiveState State;
+  //strings of the stack aliases in State
+  RecordArena Strings;
+};
@@ -0,0 +1,40 @@
+#include "RecordArena.h"
+
+RecordArena::RecordArena() : RecordCount(0), ObjectCount(0){
+}
+
+//the SpecificBumpPtrAllocators run the destructors of everything they allocated
+RecordArena::~RecordArena(){
+}
+
+RecordEntry* RecordArena::NewRecord(){
+  RecordCount++;
+  return new(Records.Allocate()) RecordEntry();
+}
+
+ObjectRecorderData* RecordArena::NewObject(StringRef name){
+  ObjectCount++;
+  return new(Objects.Allocate()) ObjectRecorderData(name);
+}
+
+const char* RecordArena::SaveString(StringRef value){
+  return Strings.insert(value).first->getKeyData();
+}
+
+void RecordArena::Adopt(std::unique_ptr<RecordArena> other){
+
+  if(other){
+    Adopted.push_back(std::move(other));
+  }
+}
+
+size_t RecordArena::GetBytesAllocated() const{
+
+  size_t total = RecordCount*sizeof(RecordEntry) + ObjectCount*sizeof(ObjectRecorderData) + Strings.getAllocator().getBytesAllocated();
+
+  for(auto& arena : Adopted){
+    total += arena->GetBytesAllocated();
+  }
+
+  return total;
+}
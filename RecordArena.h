@@ -0,0 +1,41 @@
+#pragma once
+
+#include "RecorderEntry.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Allocator.h"
+
+#include <memory>
+#include <vector>
+
+//Owns the records, object data and string literals collected during a run. They're bump allocated and all
+//freed together when the arena is destroyed, so a server handling request after request doesn't leak or
+//fragment its heap. The arenas of merged shards are adopted by the arena of the collection they're merged into
+class RecordArena{
+
+public:
+  RecordArena();
+  ~RecordArena();
+
+  RecordEntry* NewRecord();
+  ObjectRecorderData* NewObject(StringRef name);
+
+  //Returns a null terminated copy of value that lives as long as the arena, equal strings share the same copy
+  const char* SaveString(StringRef value);
+
+  //Keep another arena alive for as long as this one
+  void Adopt(std::unique_ptr<RecordArena> other);
+
+  //Bytes used by the records, objects and strings of this arena and the ones it adopted, not counting the
+  //heap memory owned by their std::string and std::vector members
+  size_t GetBytesAllocated() const;
+
+private:
+  RecordArena(const RecordArena&);
+  RecordArena& operator=(const RecordArena&);
+
+  llvm::SpecificBumpPtrAllocator<RecordEntry> Records;
+  llvm::SpecificBumpPtrAllocator<ObjectRecorderData> Objects;
+  size_t RecordCount, ObjectCount;
+  llvm::StringSet<llvm::BumpPtrAllocator> Strings;
+  std::vector<std::unique_ptr<RecordArena>> Adopted;
+};
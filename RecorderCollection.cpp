@@ -6,6 +6,8 @@
 #include "clang/AST/DeclCXX.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Sema/Sema.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/FileSystem.h"
 
 #include <iostream>
 
@@ -89,7 +91,7 @@ void RecordEntry::BuildFieldGetSet(const StringRef& objectType, const StringRef&
 }
 
 RecorderCollection::RecorderCollection(bool verbose) : 
-  SM(NULL), InModule(false), UnboundRecorder(){
+  CI(NULL), SM(NULL), InModule(false), UnboundRecorder(NULL), Arena(new RecordArena()){
    FunctionId = 0;
    Verbose = verbose;
 }
@@ -104,7 +106,7 @@ void RecorderCollection::SetCompilerInstance(clang::CompilerInstance& ci){
   CI = &ci;
 
   InModule = false;
-  PrintPolicy = new clang::PrintingPolicy(ci.getLangOpts());
+  PrintPolicy.reset(new clang::PrintingPolicy(ci.getLangOpts()));
   //functionEntry = new RecordEntry();
 }
 
@@ -183,11 +185,12 @@ void RecorderCollection::LuaCFunctionDefined(const clang::FunctionDecl *func){
   //the recorder definition has tobe on the same line as the line function is defined
   if(functionDefLineNumber != UnboundRecorder->RecordLineNumber){
     std::cerr << "Error function " << func->getName().str() << "was not on the same line number as the last Recorder definition at line " << UnboundRecorder->RecordLineNumber;
-    UnboundRecorder.reset();
+    UnboundRecorder = NULL;
     return;
   }
 
-  auto recorder = UnboundRecorder.release();
+  auto recorder = UnboundRecorder;
+  UnboundRecorder = NULL;
   
 
   //set the function name that the recorder is bound to
@@ -195,7 +198,8 @@ void RecorderCollection::LuaCFunctionDefined(const clang::FunctionDecl *func){
   
   if((recorder->Type == Recorder_GetField || recorder->Type == Recorder_SetField) && recorder->RecordOptions != "0"){
       
-    auto fieldInfo = GetFieldInfo(CI->getSema(), func->getDeclContext(), recorder->GetObjectName(), recorder->RecordOptions);
+    std::string objectName = recorder->GetObjectName().str();
+    auto fieldInfo = GetFieldInfo(CI->getSema(), func->getDeclContext(), objectName, recorder->RecordOptions);
     
     if(fieldInfo == NULL){
       std::cerr << "Error failed to get field info for function " << func->getName().str() << "\n";
@@ -230,7 +234,7 @@ void RecorderCollection::LuaCFunctionDefined(const clang::FunctionDecl *func){
     
     auto name12 = fieldInfo->getQualifiedNameAsString();
 
-    recorder->BuildFieldGetSet(recorder->GetObjectName(), fieldTypeString, "offsetof("+recorder->GetObjectName()+", "+ recorder->RecordOptions+ ")");
+    recorder->BuildFieldGetSet(objectName, fieldTypeString, "offsetof("+objectName+", "+ recorder->RecordOptions+ ")");
   }
 
   RegisterEntryToGroup(recorder);
@@ -253,8 +257,8 @@ void RecorderCollection::LuaCFunctionDefined(const clang::FunctionDecl *func){
     return;
   }
 
-  //frees previous UnboundRecorder if there was no function definition was found to attach to it
-  UnboundRecorder.reset(recorder);
+  //the recorder stays in AllFunctions and the arena if no function definition is found to attach to it
+  UnboundRecorder = recorder;
 
   //we only increment the functionId when we find a valid function definition to bind the recorder to
   UnboundRecorder->FunctionId = FunctionId;
@@ -296,19 +300,15 @@ void RecorderCollection::RegisterEntryToGroup(RecordEntry* entry){
 
 }
 
-ObjectRecorderData* RecorderCollection::GetFunctionList(std::string& objectName){
+ObjectRecorderData* RecorderCollection::GetFunctionList(StringRef objectName){
 
-  auto result = ObjectFunctions.find(objectName);
+  auto result = ObjectFunctions.insert(std::make_pair(objectName, (ObjectRecorderData*)NULL));
 
-  if(result != ObjectFunctions.end()){
-    return result->second;
+  if(result.second){
+    result.first->second = Arena->NewObject(objectName);
   }
 
-  auto returnValue = new ObjectRecorderData(objectName);
-
-  ObjectFunctions[objectName] = returnValue;
-
-  return returnValue;
+  return result.first->second;
 }
 
 void RecorderCollection::ReportError(const char* fmtmsg, const StringRef fmtarg){
@@ -320,6 +320,283 @@ void RecorderCollection::ReportError(const char* fmtmsg, const StringRef fmtarg)
   B.AddString(fmtarg);
 }
 
+//Append the records a worker collected for a single source file. Function ids are rebased so merging
+//the shards in source file order gives the same ids as parsing every file into one collection
+void RecorderCollection::MergeShard(RecorderCollection& shard){
+
+  for(RecordEntry* entry : shard.AllFunctions){
+    if(entry->FunctionId != -1){
+      entry->FunctionId += FunctionId;
+    }
+
+    AllFunctions.push_back(entry);
+  }
+
+  GobalFunctions.insert(GobalFunctions.end(), shard.GobalFunctions.begin(), shard.GobalFunctions.end());
+
+  for(auto& objectEntry : shard.ObjectFunctions){
+    GetFunctionList(objectEntry.getKey())->Merge(*objectEntry.getValue());
+  }
+
+  for(auto& path : shard.IncludedFiles){
+    FileIncluded(path);
+  }
+
+  FunctionId += shard.FunctionId;
+
+  Arena->Adopt(std::move(shard.Arena));
+  shard.Arena.reset(new RecordArena());
+}
+
+void RecorderCollection::FileIncluded(StringRef path){
+
+  llvm::SmallString<256> absolutePath(path);
+  llvm::sys::fs::make_absolute(absolutePath);
+
+  if(IncludedFileSet.insert(absolutePath).second){
+    IncludedFiles.push_back(absolutePath.str());
+  }
+}
+
+void RecorderCollection::SaveString(std::ostream& output, StringRef value){
+  output << value.size() << ' ';
+  output.write(value.data(), value.size());
+  output << '\n';
+}
+
+//names, record options and file paths, anything longer is a corrupt file
+static const size_t MaxSavedStringLength = 1 << 20;
+
+//Number of bytes left to read in the stream or SIZE_MAX when it can't seek
+static size_t GetRemainingLength(std::istream& input){
+
+  std::streampos current = input.tellg();
+
+  if(current == std::streampos(-1)){
+    return SIZE_MAX;
+  }
+
+  input.seekg(0, std::ios::end);
+  std::streampos end = input.tellg();
+  input.seekg(current);
+
+  return end == std::streampos(-1) ? SIZE_MAX : (size_t)(end-current);
+}
+
+bool RecorderCollection::LoadString(std::istream& input, std::string& value){
+
+  size_t length;
+
+  if(!(input >> length) || input.get() != ' '){
+    return false;
+  }
+
+  //the length comes from the file so a corrupt one is checked against whats left of it before anything is allocated
+  if(length > MaxSavedStringLength || length > GetRemainingLength(input)){
+    return false;
+  }
+
+  value.resize(length);
+  input.read(&value[0], length);
+
+  return (size_t)input.gcount() == length && input.get() == '\n';
+}
+
+void RecorderCollection::SavePushEntry(std::ostream& output, const PushEntry& pushValue){
+
+  output << pushValue.Type << ' ';
+
+  if(pushValue.HasString()){
+    SaveString(output, pushValue.StringLiteral);
+  }else{
+    output << pushValue.StackSlot << '\n';
+  }
+}
+
+bool RecorderCollection::LoadPushEntry(std::istream& input, PushEntry& pushValue, RecordArena& arena){
+
+  int pushType;
+
+  if(!(input >> pushType) || input.get() != ' '){
+    return false;
+  }
+
+  pushValue = PushEntry((PushType)pushType);
+
+  if(pushValue.HasString()){
+    std::string value;
+
+    if(!LoadString(input, value)){
+      return false;
+    }
+
+    pushValue.StringLiteral = arena.SaveString(value);
+    return true;
+  }
+
+  return !!(input >> pushValue.StackSlot);
+}
+
+void RecorderCollection::SaveRecords(std::ostream& output) const{
+
+  llvm::DenseMap<const RecordEntry*, int> entryIndex;
+
+  output << FunctionId << ' ' << AllFunctions.size() << '\n';
+
+  for(const RecordEntry* entry : AllFunctions){
+    int index = entryIndex.size();
+    entryIndex[entry] = index;
+
+    output << entry->Type << ' ' << entry->Valid << ' ' << entry->NeedsMembersTable << ' ' << entry->NoRecorderExtern << ' ' 
+           << entry->FunctionId << ' ' << entry->RecordLineNumber << ' ' << entry->PushStack.size() << '\n';
+
+    SaveString(output, entry->Name);
+    SaveString(output, entry->TraceRecorder);
+    SaveString(output, entry->RequiredFlag);
+    SaveString(output, entry->RecordOptions);
+    SaveString(output, entry->RecorderFunctionName);
+    SaveString(output, entry->RecorderLine);
+
+    for(const PushEntry& pushValue : entry->PushStack){
+      SavePushEntry(output, pushValue);
+    }
+  }
+
+  output << GobalFunctions.size() << '\n';
+
+  for(const RecordEntry* entry : GobalFunctions){
+    output << entryIndex[entry] << '\n';
+  }
+
+  output << ObjectFunctions.size() << '\n';
+
+  for(auto& objectEntry : ObjectFunctions){
+    const ObjectRecorderData* object = objectEntry.getValue();
+
+    SaveString(output, objectEntry.getKey());
+    output << object->ObjectType << ' ' << object->NeedsFlagArg << ' ' << object->NeedsMemberTable << ' ' 
+           << object->MemberFunctions.size() << ' ' << object->MetaFunctions.size() << '\n';
+
+    for(const RecordEntry* entry : object->MemberFunctions){
+      output << entryIndex[entry] << '\n';
+    }
+
+    for(const RecordEntry* entry : object->MetaFunctions){
+      output << entryIndex[entry] << '\n';
+    }
+  }
+
+  output << IncludedFiles.size() << '\n';
+
+  for(auto& path : IncludedFiles){
+    SaveString(output, path);
+  }
+}
+
+bool RecorderCollection::LoadRecords(std::istream& input){
+
+  size_t count;
+
+  if(!(input >> FunctionId >> count)){
+    return false;
+  }
+
+  std::vector<RecordEntry*> entries;
+
+  auto readEntryList = [&](std::vector<RecordEntry*>& list, size_t length){
+    for(size_t i = 0; i != length ;i++){
+      size_t index;
+
+      if(!(input >> index) || index >= entries.size()){
+        return false;
+      }
+
+      list.push_back(entries[index]);
+    }
+
+    return true;
+  };
+
+  for(size_t i = 0; i != count ;i++){
+    auto entry = Arena->NewRecord();
+    int type;
+    size_t pushCount;
+
+    entries.push_back(entry);
+
+    if(!(input >> type >> entry->Valid >> entry->NeedsMembersTable >> entry->NoRecorderExtern >> entry->FunctionId >> entry->RecordLineNumber >> pushCount) ||
+       input.get() != '\n'){
+      return false;
+    }
+
+    entry->Type = (RecorderType)type;
+
+    if(!LoadString(input, entry->Name) || !LoadString(input, entry->TraceRecorder) || !LoadString(input, entry->RequiredFlag) ||
+       !LoadString(input, entry->RecordOptions) || !LoadString(input, entry->RecorderFunctionName) || !LoadString(input, entry->RecorderLine)){
+      return false;
+    }
+
+    for(size_t j = 0; j != pushCount ;j++){
+      PushEntry pushValue;
+
+      if(!LoadPushEntry(input, pushValue, *Arena)){
+        return false;
+      }
+
+      entry->PushStack.push_back(pushValue);
+    }
+  }
+
+  AllFunctions.insert(AllFunctions.end(), entries.begin(), entries.end());
+
+  if(!(input >> count) || !readEntryList(GobalFunctions, count)){
+    return false;
+  }
+
+  if(!(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  for(size_t i = 0; i != count ;i++){
+    std::string name;
+    int objectType;
+    size_t memberCount, metaCount;
+
+    if(!LoadString(input, name)){
+      return false;
+    }
+
+    auto object = GetFunctionList(name);
+
+    if(!(input >> objectType >> object->NeedsFlagArg >> object->NeedsMemberTable >> memberCount >> metaCount)){
+      return false;
+    }
+
+    object->ObjectType = (Object_Type)objectType;
+
+    if(!readEntryList(object->MemberFunctions, memberCount) || !readEntryList(object->MetaFunctions, metaCount) ||
+       input.get() != '\n'){
+      return false;
+    }
+  }
+
+  if(!(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  for(size_t i = 0; i != count ;i++){
+    std::string path;
+
+    if(!LoadString(input, path)){
+      return false;
+    }
+
+    FileIncluded(path);
+  }
+
+  return true;
+}
+
 void RecorderCollection::ModuleDefined(std::string& name, std::string& moduleType){
   
   auto object = GetFunctionList(name);
@@ -1,9 +1,13 @@
 
 #pragma once
 
-#include "RecorderEntry.h"
-#include <map>
+#include "RecordArena.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/DenseSet.h"
+#include "clang/Basic/SourceLocation.h"
 #include <memory>
+#include <iosfwd>
 
 namespace clang{
   class CompilerInstance;
@@ -22,6 +26,7 @@ public:
   void SetCompilerInstance(clang::CompilerInstance& ci);
   
   void NewSourceFile(){
+    AnnotatedFiles.clear();
   }
 
   void SetInModule(StringRef& name){
@@ -33,15 +38,39 @@ public:
   void RecorderFinalized(RecordEntry* recorder);
   void LuaCFunctionDefined(const clang::FunctionDecl *func);
 
+  //The shard's arena is adopted by this collection's so its records live as long as the merged ones
+  void MergeShard(RecorderCollection& shard);
+
+  RecordArena& GetArena(){
+    return *Arena;
+  }
+
+  void FileIncluded(StringRef path);
+
+  //Serialize the records collected from a source file so they can be replayed later by the ResultCache
+  void SaveRecords(std::ostream& output) const;
+  bool LoadRecords(std::istream& input);
+
+  static void SaveString(std::ostream& output, StringRef value);
+  static bool LoadString(std::istream& input, std::string& value);
+  static void SavePushEntry(std::ostream& output, const PushEntry& pushValue);
+  static bool LoadPushEntry(std::istream& input, PushEntry& pushValue, RecordArena& arena);
+
 private:
   void RegisterEntryToGroup(RecordEntry* entry);
   void ReportError(const char* fmtmsg, StringRef fmtvalue);
-  ObjectRecorderData* GetFunctionList(std::string& objectName);
+  ObjectRecorderData* GetFunctionList(StringRef objectName);
 
 public:
   std::vector<RecordEntry*> GobalFunctions;
   std::vector<RecordEntry*> AllFunctions;
-  std::map<std::string, ObjectRecorderData*> ObjectFunctions;
+  //unordered, RecorderTable sorts the objects by name for output
+  llvm::StringMap<ObjectRecorderData*> ObjectFunctions;
+  //every source and header file that was entered while collecting the records
+  std::vector<std::string> IncludedFiles;
+  //files in the current source file that contained LJFF_ directives, only functions declared in these or 
+  //the main file can have recorders bound to them
+  llvm::DenseSet<clang::FileID> AnnotatedFiles;
 
 private:
   bool Verbose;
@@ -49,9 +78,11 @@ private:
   clang::SourceManager* SM;
   
   int FunctionId;
-  std::unique_ptr<RecordEntry> UnboundRecorder;
+  RecordEntry* UnboundRecorder;
 
-  clang::PrintingPolicy* PrintPolicy;
+  std::unique_ptr<clang::PrintingPolicy> PrintPolicy;
+  std::unique_ptr<RecordArena> Arena;
 
   bool InModule;
+  llvm::StringSet<> IncludedFileSet;
 };
\ No newline at end of file
@@ -25,9 +25,9 @@ public:
     :Type(PushType_Invalid), StackSlot(0){
   }
 
-  PushEntry(const StringRef& strLiteral){
-    StringLiteral = new std::string(strLiteral);
-    Type = PushType_String;
+  //strLiteral must be owned by the RecordArena of the records the entry ends up in
+  explicit PushEntry(const char* strLiteral) 
+    : Type(PushType_String), StringLiteral(strLiteral){
   }
   
   PushEntry(PushType typeNum) 
@@ -43,10 +43,15 @@ public:
     Type = PushType_StackSlot;
   }
 
+  //String pushes and the MT and Global table names
+  bool HasString() const{
+    return Type == PushType_String || Type == PushType_MT || Type == PushType_Global;
+  }
+
 public:
   PushType Type;
   union{
-    std::string* StringLiteral;
+    const char* StringLiteral;
     int StackSlot;
   };
 };
@@ -87,15 +92,15 @@ public:
 
   void BuildFieldGetSet(const StringRef& objectType, const StringRef& fieldType, const StringRef& fieldOffset);
 
-  std::string GetObjectName(){
+  StringRef GetObjectName() const{
 
-    int underSlash = Name.find('_');
+    size_t underSlash = Name.find('_');
 
     if(underSlash == std::string::npos){
       return "";
     }
 
-    return Name.substr(0, underSlash);
+    return StringRef(Name).substr(0, underSlash);
   }
 
 public:
@@ -120,8 +125,8 @@ enum Object_Type{
 class ObjectRecorderData{
 
 public:
-  ObjectRecorderData(std::string& name) : 
-    Name(name), NeedsFlagArg(false), NeedsMemberTable(false), ObjectType(Object_Unknown){
+  ObjectRecorderData(StringRef name) : 
+    Name(name.str()), NeedsFlagArg(false), NeedsMemberTable(false), ObjectType(Object_Unknown){
   }
 
   void AddMetaFunction(RecordEntry* entry){
@@ -138,6 +143,20 @@ public:
     FunctionAdded(entry);
   }
 
+  //Append the functions another source file defined for the same object
+  void Merge(const ObjectRecorderData& other){
+
+    if(other.ObjectType != Object_Unknown){
+      ObjectType = other.ObjectType;
+    }
+
+    MemberFunctions.insert(MemberFunctions.end(), other.MemberFunctions.begin(), other.MemberFunctions.end());
+    MetaFunctions.insert(MetaFunctions.end(), other.MetaFunctions.begin(), other.MetaFunctions.end());
+
+    NeedsFlagArg |= other.NeedsFlagArg;
+    NeedsMemberTable |= other.NeedsMemberTable;
+  }
+
 private:
   void FunctionAdded(RecordEntry* entry){
 
@@ -0,0 +1,119 @@
+#include "RecorderTable.h"
+#include "RecorderCollection.h"
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <algorithm>
+
+using std::string;
+
+RecorderTable::RecorderTable(const RecorderCollection& records){
+
+  //id 0 is the empty string so empty names can be checked without looking at the string
+  Intern("");
+
+  size_t functionCount = records.AllFunctions.size();
+  llvm::DenseMap<const RecordEntry*, FuncIndex> functionIndex;
+
+  FunctionName.reserve(functionCount);
+  TraceRecorder.reserve(functionCount);
+  RecordOptions.reserve(functionCount);
+  RequiredFlag.reserve(functionCount);
+  RecorderId.reserve(functionCount);
+  FunctionFlag.reserve(functionCount);
+  MemberNameStart.reserve(functionCount);
+  PushStart.reserve(functionCount+1);
+
+  for(const RecordEntry* entry : records.AllFunctions){
+    FuncIndex index = (FuncIndex)FunctionName.size();
+    functionIndex[entry] = index;
+
+    FunctionName.push_back(Intern(entry->Name));
+    TraceRecorder.push_back(Intern(entry->TraceRecorder));
+    RecordOptions.push_back(Intern(entry->RecordOptions));
+    RequiredFlag.push_back(Intern(entry->RequiredFlag));
+    RecorderId.push_back(entry->FunctionId);
+
+    FunctionFlag.push_back((entry->Valid ? FunctionFlag_Valid : 0) | (entry->NeedsMembersTable ? FunctionFlag_NeedsMembersTable : 0) |
+                           (entry->NoRecorderExtern ? FunctionFlag_NoRecorderExtern : 0));
+
+    //names without an under slash are used as they are
+    size_t split = entry->Name.find('_');
+    assert(split == string::npos || split < UINT16_MAX);
+    MemberNameStart.push_back(split == string::npos ? 0 : (uint16_t)(split+1));
+
+    PushStart.push_back((uint32_t)Pushes.size());
+
+    for(PushEntry pushValue : entry->PushStack){
+      if(pushValue.HasString()){
+        pushValue.StringLiteral = Strings[Intern(pushValue.StringLiteral)];
+      }
+
+      Pushes.push_back(pushValue);
+    }
+  }
+
+  PushStart.push_back((uint32_t)Pushes.size());
+
+  //sorted so the registration functions come out in the same order whatever order the objects were found in
+  std::vector<std::pair<StringRef, const ObjectRecorderData*>> objects;
+  objects.reserve(records.ObjectFunctions.size());
+
+  for(auto& objectEntry : records.ObjectFunctions){
+    objects.push_back(std::make_pair(objectEntry.getKey(), objectEntry.getValue()));
+  }
+
+  std::sort(objects.begin(), objects.end(), [](const std::pair<StringRef, const ObjectRecorderData*>& a, 
+                                               const std::pair<StringRef, const ObjectRecorderData*>& b){
+    return a.first < b.first;
+  });
+
+  auto addFunctions = [&](const std::vector<RecordEntry*>& functions){
+    for(const RecordEntry* entry : functions){
+      assert(functionIndex.count(entry) && "object function missing from AllFunctions");
+      ObjectFunctions.push_back(functionIndex[entry]);
+    }
+  };
+
+  for(auto& objectEntry : objects){
+    const ObjectRecorderData* object = objectEntry.second;
+
+    ObjectName.push_back(Intern(objectEntry.first));
+    ObjectType.push_back(object->ObjectType);
+    ObjectFlag.push_back((object->NeedsFlagArg ? ObjectFlag_NeedsFlagArg : 0) | (object->NeedsMemberTable ? ObjectFlag_NeedsMemberTable : 0));
+
+    MemberStart.push_back((uint32_t)ObjectFunctions.size());
+    addFunctions(object->MemberFunctions);
+    MetaStart.push_back((uint32_t)ObjectFunctions.size());
+    addFunctions(object->MetaFunctions);
+  }
+
+  //end of the last object's meta functions
+  MemberStart.push_back((uint32_t)ObjectFunctions.size());
+
+  for(const RecordEntry* entry : records.GobalFunctions){
+    GlobalFunctions.push_back(functionIndex[entry]);
+  }
+}
+
+StringId RecorderTable::Intern(StringRef value){
+
+  auto result = StringIds.insert(std::make_pair(value, (StringId)Strings.size()));
+
+  if(result.second){
+    Strings.push_back(result.first->getKeyData());
+  }
+
+  return result.first->getValue();
+}
+
+bool RecorderTable::RecordersValid() const{
+
+  for(uint8_t flags : FunctionFlag){
+    if((flags & FunctionFlag_Valid) == 0){
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "RecorderEntry.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
+
+#include <cstdint>
+#include <vector>
+
+class RecorderCollection;
+
+typedef uint32_t StringId;
+typedef uint32_t FuncIndex;
+typedef uint32_t ObjectIndex;
+
+enum FunctionFlags{
+  FunctionFlag_Valid = 1,
+  FunctionFlag_NeedsMembersTable = 2,
+  FunctionFlag_NoRecorderExtern = 4,
+};
+
+enum ObjectFlags{
+  ObjectFlag_NeedsFlagArg = 1,
+  ObjectFlag_NeedsMemberTable = 2,
+};
+
+//Compact read only copy of the merged records the output is generated from. Each field is its own array indexed
+//by a dense function or object index and every name is interned once so emission just walks contiguous arrays.
+//Functions keep the order they were collected in and objects are sorted by name
+class RecorderTable{
+
+public:
+  explicit RecorderTable(const RecorderCollection& records);
+
+  size_t GetFunctionCount() const{
+    return FunctionName.size();
+  }
+
+  size_t GetObjectCount() const{
+    return ObjectName.size();
+  }
+
+  //Interned strings are null terminated, id 0 is always the empty string
+  const char* GetString(StringId id) const{
+    return Strings[id];
+  }
+
+  size_t GetStringCount() const{
+    return Strings.size();
+  }
+
+  bool IsValid(FuncIndex func) const{
+    return (FunctionFlag[func] & FunctionFlag_Valid) != 0;
+  }
+
+  //The function name without the object name and under slash in front of it
+  const char* GetMemberName(FuncIndex func) const{
+    return Strings[FunctionName[func]]+MemberNameStart[func];
+  }
+
+  llvm::ArrayRef<PushEntry> GetPushes(FuncIndex func) const{
+    return llvm::makeArrayRef(Pushes).slice(PushStart[func], PushStart[func+1]-PushStart[func]);
+  }
+
+  llvm::ArrayRef<FuncIndex> GetMemberFunctions(ObjectIndex object) const{
+    return llvm::makeArrayRef(ObjectFunctions).slice(MemberStart[object], MetaStart[object]-MemberStart[object]);
+  }
+
+  llvm::ArrayRef<FuncIndex> GetMetaFunctions(ObjectIndex object) const{
+    return llvm::makeArrayRef(ObjectFunctions).slice(MetaStart[object], MemberStart[object+1]-MetaStart[object]);
+  }
+
+  //The member functions of the object followed by its meta functions
+  llvm::ArrayRef<FuncIndex> GetObjectFunctions(ObjectIndex object) const{
+    return llvm::makeArrayRef(ObjectFunctions).slice(MemberStart[object], MemberStart[object+1]-MemberStart[object]);
+  }
+
+  size_t CountValid(llvm::ArrayRef<FuncIndex> functions) const{
+
+    size_t count = 0;
+
+    for(FuncIndex func : functions){
+      count += IsValid(func) ? 1 : 0;
+    }
+
+    return count;
+  }
+
+  bool RecordersValid() const;
+
+private:
+  StringId Intern(StringRef value);
+
+public:
+  //function columns
+  std::vector<StringId> FunctionName, TraceRecorder, RecordOptions, RequiredFlag;
+  std::vector<int> RecorderId;
+  std::vector<uint8_t> FunctionFlag;
+  //offset into the name where the member name starts, cached so the object name is only split once
+  std::vector<uint16_t> MemberNameStart;
+  //the pushes of function i are Pushes[PushStart[i]] to Pushes[PushStart[i+1]], their strings are interned
+  std::vector<uint32_t> PushStart;
+  std::vector<PushEntry> Pushes;
+
+  //object columns, the member functions of object i come first in ObjectFunctions followed by its meta functions
+  std::vector<StringId> ObjectName;
+  std::vector<Object_Type> ObjectType;
+  std::vector<uint8_t> ObjectFlag;
+  std::vector<uint32_t> MemberStart, MetaStart;
+  std::vector<FuncIndex> ObjectFunctions;
+
+  std::vector<FuncIndex> GlobalFunctions;
+
+private:
+  std::vector<const char*> Strings;
+  llvm::StringMap<StringId, llvm::BumpPtrAllocator> StringIds;
+};
@@ -0,0 +1,185 @@
+#include "ResultCache.h"
+#include "RecorderCollection.h"
+
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <fstream>
+#include <sstream>
+
+using std::string;
+
+//bump this when the layout of the saved records changes so old entries are ignored
+static const char CacheFormat[] = "buildvm_clang-cache 1";
+
+static string HashString(llvm::StringRef data){
+
+  llvm::MD5 hash;
+  llvm::MD5::MD5Result result;
+  llvm::SmallString<32> hexResult;
+
+  hash.update(data);
+  hash.final(result);
+  llvm::MD5::stringifyResult(result, hexResult);
+
+  return hexResult.str();
+}
+
+ResultCache::ResultCache(const std::string& cacheDir, bool keepInMemory) :
+  CacheDir(cacheDir), KeepInMemory(keepInMemory), Hits(0), Misses(0){
+
+  llvm::sys::fs::create_directories(CacheDir);
+}
+
+void ResultCache::NewRun(){
+
+  std::lock_guard<std::mutex> lock(FileHashLock);
+  FileHashes.clear();
+
+  Hits = 0;
+  Misses = 0;
+}
+
+string ResultCache::GetEntryPath(const std::string& sourcePath){
+
+  llvm::SmallString<256> entryPath(CacheDir);
+  llvm::sys::path::append(entryPath, HashString(clang::tooling::getAbsolutePath(sourcePath))+".ljcache");
+
+  return entryPath.str();
+}
+
+string ResultCache::GetCommandLineHash(const std::vector<std::string>& commandLine){
+
+  string joined;
+
+  //skip the executable path so moving the tool doesn't invalidate the cache
+  for(size_t i = 1; i < commandLine.size() ;i++){
+    joined += commandLine[i];
+    joined += '\0';
+  }
+
+  return HashString(joined);
+}
+
+string ResultCache::GetFileHash(llvm::StringRef path){
+
+  {
+    std::lock_guard<std::mutex> lock(FileHashLock);
+
+    auto it = FileHashes.find(path);
+
+    if(it != FileHashes.end()){
+      return it->second;
+    }
+  }
+
+  auto buffer = llvm::MemoryBuffer::getFile(path);
+
+  //a missing file never matches a stored hash
+  string hash = buffer ? HashString((*buffer)->getBuffer()) : "";
+
+  std::lock_guard<std::mutex> lock(FileHashLock);
+  FileHashes[path] = hash;
+
+  return hash;
+}
+
+bool ResultCache::Load(const std::string& sourcePath, const std::vector<std::string>& commandLine, RecorderCollection& recorders){
+
+  string entryPath = GetEntryPath(sourcePath);
+  std::istringstream memoryInput(std::ios::binary);
+  std::ifstream fileInput;
+  std::istream* entryInput = &fileInput;
+
+  if(KeepInMemory){
+    std::lock_guard<std::mutex> lock(EntryLock);
+    auto it = MemoryEntries.find(entryPath);
+
+    if(it != MemoryEntries.end()){
+      memoryInput.str(it->second);
+      entryInput = &memoryInput;
+    }
+  }
+
+  if(entryInput == &fileInput){
+    fileInput.open(entryPath, std::ios::binary);
+  }
+
+  std::istream& input = *entryInput;
+  string line, path, hash;
+
+  if(!input || !std::getline(input, line) || line != CacheFormat ||
+     !std::getline(input, line) || line != GetCommandLineHash(commandLine)){
+    Misses++;
+    return false;
+  }
+
+  size_t dependencyCount;
+
+  if(!(input >> dependencyCount) || input.get() != '\n'){
+    Misses++;
+    return false;
+  }
+
+  for(size_t i = 0; i != dependencyCount ;i++){
+    if(!std::getline(input, path) || !std::getline(input, hash) || GetFileHash(path) != hash){
+      Misses++;
+      return false;
+    }
+  }
+
+  //load into a separate collection first so a corrupt entry can't leave half the records behind
+  RecorderCollection cachedRecords(false);
+
+  if(!cachedRecords.LoadRecords(input)){
+    Misses++;
+    return false;
+  }
+
+  recorders.MergeShard(cachedRecords);
+  Hits++;
+
+  return true;
+}
+
+void ResultCache::Store(const std::string& sourcePath, const std::vector<std::string>& commandLine, const RecorderCollection& recorders){
+
+  std::ostringstream output(std::ios::binary);
+
+  output << CacheFormat << '\n' << GetCommandLineHash(commandLine) << '\n';
+  output << recorders.IncludedFiles.size() << '\n';
+
+  for(auto& path : recorders.IncludedFiles){
+    output << path << '\n' << GetFileHash(path) << '\n';
+  }
+
+  recorders.SaveRecords(output);
+
+  if(KeepInMemory){
+    std::lock_guard<std::mutex> lock(EntryLock);
+    MemoryEntries[GetEntryPath(sourcePath)] = output.str();
+  }
+
+  //write to a temporary file first and rename it over the entry so a concurrent run never sees a partial entry
+  int fd;
+  llvm::SmallString<256> tempPath(CacheDir);
+  llvm::sys::path::append(tempPath, "entry-%%%%%%%%.tmp");
+
+  if(llvm::sys::fs::createUniqueFile(tempPath, fd, tempPath)){
+    return;
+  }
+
+  {
+    llvm::raw_fd_ostream tempFile(fd, true);
+    tempFile << output.str();
+  }
+
+  if(llvm::sys::fs::rename(tempPath, GetEntryPath(sourcePath))){
+    llvm::sys::fs::remove(tempPath);
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class RecorderCollection;
+
+//On disk cache of the records collected from each source file. An entry is keyed by the source file path and
+//stores a content hash of the source and every header it included, when none of them have changed the records
+//are replayed into the collection instead of parsing the file again
+class ResultCache{
+
+public:
+  //keepInMemory also keeps every entry in memory so a long running server never has to read them back from disk
+  explicit ResultCache(const std::string& cacheDir, bool keepInMemory = false);
+
+  //Forget the file hashes and counts of the last run so changes made since then are seen
+  void NewRun();
+
+  bool Load(const std::string& sourcePath, const std::vector<std::string>& commandLine, RecorderCollection& recorders);
+  void Store(const std::string& sourcePath, const std::vector<std::string>& commandLine, const RecorderCollection& recorders);
+
+  //Content hash of a file, hashes are only computed once per run since most headers are shared by every source file
+  std::string GetFileHash(llvm::StringRef path);
+
+  unsigned GetHitCount() const{
+    return Hits;
+  }
+
+  unsigned GetMissCount() const{
+    return Misses;
+  }
+
+private:
+  std::string GetEntryPath(const std::string& sourcePath);
+  static std::string GetCommandLineHash(const std::vector<std::string>& commandLine);
+
+  std::string CacheDir;
+  bool KeepInMemory;
+
+  std::mutex EntryLock;
+  llvm::StringMap<std::string> MemoryEntries;
+
+  std::mutex FileHashLock;
+  llvm::StringMap<std::string> FileHashes;
+
+  std::atomic<unsigned> Hits, Misses;
+};
@@ -0,0 +1,496 @@
+#include "Server.h"
+#include "RecorderCollection.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if !defined(_WIN32)
+  #include <errno.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <string.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/un.h>
+  #include <unistd.h>
+#endif
+
+#if defined(__linux__)
+  #include <sys/inotify.h>
+#endif
+
+using std::string;
+
+static void SaveList(std::ostream& output, const std::vector<string>& list){
+
+  output << list.size() << '\n';
+
+  for(auto& value : list){
+    RecorderCollection::SaveString(output, value);
+  }
+}
+
+static bool LoadList(std::istream& input, std::vector<string>& list){
+
+  size_t count;
+
+  if(!(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  list.resize(count);
+
+  for(auto& value : list){
+    if(!RecorderCollection::LoadString(input, value)){
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void GenerateRequest::Save(std::ostream& output) const{
+  RecorderCollection::SaveString(output, WorkingDir);
+  RecorderCollection::SaveString(output, OutputFile);
+  RecorderCollection::SaveString(output, DepFile);
+  SaveList(output, Sources);
+  SaveList(output, Includes);
+  SaveList(output, CompilerArgs);
+  output << JobCount << ' ' << UsePrefixHeader << ' ' << DeclarationsOnly << '\n';
+  SaveList(output, PrefixIncludes);
+  output << Verbose << ' ' << UseSharedFiles << '\n';
+  output << RegistrationTables << ' ' << RegistrationStream << ' ' << SplitOutput << ' ' << LazyObjects << ' ' << DenseRecorders << ' '
+         << PrehashKeys << '\n';
+}
+
+bool GenerateRequest::Load(std::istream& input){
+  return RecorderCollection::LoadString(input, WorkingDir) && RecorderCollection::LoadString(input, OutputFile) &&
+         RecorderCollection::LoadString(input, DepFile) && LoadList(input, Sources) && LoadList(input, Includes) &&
+         LoadList(input, CompilerArgs) && (input >> JobCount >> UsePrefixHeader >> DeclarationsOnly) && input.get() == '\n' &&
+         LoadList(input, PrefixIncludes) && (input >> Verbose >> UseSharedFiles) && input.get() == '\n' &&
+         (input >> RegistrationTables >> RegistrationStream >> SplitOutput >> LazyObjects >> DenseRecorders >> PrehashKeys) &&
+         input.get() == '\n';
+}
+
+std::string GetDefaultSocketPath(){
+
+  llvm::SmallString<128> socketPath;
+
+#if !defined(_WIN32)
+  const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+
+  if(runtimeDir != NULL && runtimeDir[0] != '\0'){
+    socketPath = runtimeDir;
+  }else{
+    //the temp directory is shared so the socket goes in a directory only this user can get into
+    llvm::sys::path::system_temp_directory(true, socketPath);
+    llvm::sys::path::append(socketPath, "buildvm_clang-" + std::to_string(geteuid()));
+    mkdir(socketPath.c_str(), 0700);
+  }
+#else
+  llvm::sys::path::system_temp_directory(true, socketPath);
+#endif
+
+  llvm::sys::path::append(socketPath, "buildvm_clang.sock");
+
+  return socketPath.str();
+}
+
+#if defined(_WIN32)
+
+int RunServer(const std::string& socketPath, bool watch, bool verbose, const GenerateHandler& handler){
+  std::cout << "Server mode is not supported on this platform\n";
+  return 1;
+}
+
+int RunClient(const std::string& socketPath, const GenerateRequest& request){
+  return -1;
+}
+
+#else
+
+static bool WriteAll(int fd, const string& data){
+
+  size_t written = 0;
+
+  while(written != data.size()){
+    ssize_t result = write(fd, data.data()+written, data.size()-written);
+
+    if(result < 0 && errno == EINTR){
+      continue;
+    }
+
+    if(result <= 0){
+      return false;
+    }
+
+    written += result;
+  }
+
+  return true;
+}
+
+//read until the other side shuts down its end of the socket
+static bool ReadAll(int fd, string& data){
+
+  char buffer[4096];
+
+  while(true){
+    ssize_t result = read(fd, buffer, sizeof(buffer));
+
+    if(result < 0 && errno == EINTR){
+      continue;
+    }
+
+    if(result < 0){
+      return false;
+    }
+
+    if(result == 0){
+      return true;
+    }
+
+    data.append(buffer, result);
+  }
+}
+
+//Only talk to a process of the same user, anyone could have bound the socket path or connected to it otherwise
+static bool IsPeerSameUser(int fd){
+
+#if defined(__linux__)
+  ucred cred;
+  socklen_t length = sizeof(cred);
+
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && cred.uid == geteuid();
+#else
+  uid_t uid;
+  gid_t gid;
+
+  return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#endif
+}
+
+static bool GetSocketAddress(const string& socketPath, sockaddr_un& address){
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    return false;
+  }
+
+  strcpy(address.sun_path, socketPath.c_str());
+
+  return true;
+}
+
+//Run the handler with stdout and stderr sent to a temporary file so everything clang and the generator
+//print can be passed back to the client
+static int RunCaptured(const GenerateHandler& handler, const GenerateRequest& request, std::vector<string>& inputs, string& log){
+
+  int logFd;
+  llvm::SmallString<128> logPath;
+
+  if(llvm::sys::fs::createTemporaryFile("buildvm_clang-server", "log", logFd, logPath)){
+    return handler(request, inputs);
+  }
+
+  std::cout.flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  int savedOut = dup(STDOUT_FILENO), savedErr = dup(STDERR_FILENO);
+  dup2(logFd, STDOUT_FILENO);
+  dup2(logFd, STDERR_FILENO);
+
+  int exitCode = handler(request, inputs);
+
+  std::cout.flush();
+  llvm::outs().flush();
+  llvm::errs().flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  dup2(savedOut, STDOUT_FILENO);
+  dup2(savedErr, STDERR_FILENO);
+  close(savedOut);
+  close(savedErr);
+  close(logFd);
+
+  std::ifstream logFile(logPath.c_str(), std::ios::binary);
+  std::ostringstream logText;
+  logText << logFile.rdbuf();
+  log = logText.str();
+
+  llvm::sys::fs::remove(logPath);
+
+  return exitCode;
+}
+
+//Watches the directories of the inputs of the last request since editors often replace a file instead of writing to it
+class InputWatcher{
+
+public:
+  InputWatcher() : Fd(-1){
+#if defined(__linux__)
+    Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+  }
+
+  ~InputWatcher(){
+    if(Fd != -1){
+      close(Fd);
+    }
+  }
+
+  int GetFd() const{
+    return Fd;
+  }
+
+  void Watch(const std::vector<string>& inputs){
+#if defined(__linux__)
+    for(auto& dir : Dirs){
+      inotify_rm_watch(Fd, dir.first);
+    }
+
+    Dirs.clear();
+    Files.clear();
+
+    llvm::StringSet<> watchedDirs;
+
+    for(auto& path : inputs){
+      Files.insert(path);
+
+      string dir = llvm::sys::path::parent_path(path);
+
+      if(!watchedDirs.insert(dir).second){
+        continue;
+      }
+
+      int wd = inotify_add_watch(Fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE);
+
+      if(wd != -1){
+        Dirs.push_back(std::make_pair(wd, dir));
+      }
+    }
+#endif
+  }
+
+  //Drain the pending events, returns true if any of them was for one of the inputs
+  bool InputsChanged(){
+
+    bool changed = false;
+
+#if defined(__linux__)
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while((length = read(Fd, buffer, sizeof(buffer))) > 0){
+      for(char* ptr = buffer; ptr < buffer+length; ptr += sizeof(inotify_event) + ((inotify_event*)ptr)->len){
+        auto event = (inotify_event*)ptr;
+
+        for(auto& dir : Dirs){
+          if(dir.first != event->wd || event->len == 0){
+            continue;
+          }
+
+          llvm::SmallString<256> path(dir.second);
+          llvm::sys::path::append(path, event->name);
+
+          changed = changed || Files.count(path) != 0;
+        }
+      }
+    }
+#endif
+
+    return changed;
+  }
+
+private:
+  int Fd;
+  std::vector<std::pair<int, string>> Dirs;
+  llvm::StringSet<> Files;
+};
+
+int RunServer(const std::string& socketPath, bool watch, bool verbose, const GenerateHandler& handler){
+
+  sockaddr_un address;
+
+  if(!GetSocketAddress(socketPath, address)){
+    std::cout << "Socket path is too long: " << socketPath << "\n";
+    return 1;
+  }
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  //a client that goes away before reading its reply shouldn't take the server with it
+  signal(SIGPIPE, SIG_IGN);
+
+  //remove the socket left behind by a server that was killed
+  unlink(socketPath.c_str());
+
+  if(listenFd == -1 || bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 16) != 0){
+    std::cout << "Failed to listen on " << socketPath << ": " << strerror(errno) << "\n";
+    return 1;
+  }
+
+  if(verbose){
+    std::cout << "Listening on " << socketPath << "\n";
+  }
+
+  InputWatcher watcher;
+  GenerateRequest lastRequest;
+  bool hasLastRequest = false, inputsChanged = false;
+
+  if(watch && watcher.GetFd() == -1){
+    std::cout << "Watching the inputs is not supported on this platform\n";
+    watch = false;
+  }
+
+  while(true){
+    pollfd fds[2] = {{listenFd, POLLIN, 0}, {watcher.GetFd(), POLLIN, 0}};
+
+    //wait a little after a change since saving files often comes in bursts
+    int ready = poll(fds, watch ? 2 : 1, inputsChanged ? 200 : -1);
+
+    if(ready < 0){
+      if(errno == EINTR){
+        continue;
+      }
+      break;
+    }
+
+    if(ready == 0 && inputsChanged){
+      inputsChanged = false;
+
+      std::vector<string> inputs;
+
+      if(chdir(lastRequest.WorkingDir.c_str()) == 0){
+        int exitCode = handler(lastRequest, inputs);
+
+        if(verbose){
+          std::cout << "Regenerated " << lastRequest.OutputFile << " after its inputs changed, exit code " << exitCode << "\n";
+        }
+
+        watcher.Watch(inputs);
+      }
+      continue;
+    }
+
+    if(watch && (fds[1].revents & POLLIN) && watcher.InputsChanged() && hasLastRequest){
+      inputsChanged = true;
+    }
+
+    if(!(fds[0].revents & POLLIN)){
+      continue;
+    }
+
+    int clientFd = accept(listenFd, NULL, NULL);
+
+    if(clientFd == -1){
+      continue;
+    }
+
+    if(!IsPeerSameUser(clientFd)){
+      if(verbose){
+        std::cout << "Rejected a client run by another user\n";
+      }
+
+      close(clientFd);
+      continue;
+    }
+
+    string requestData, log;
+    GenerateRequest request;
+    std::istringstream requestInput(std::ios::binary);
+    int exitCode = 1;
+
+    if(ReadAll(clientFd, requestData)){
+      requestInput.str(requestData);
+    }
+
+    if(request.Load(requestInput) && chdir(request.WorkingDir.c_str()) == 0){
+      std::vector<string> inputs;
+
+      exitCode = RunCaptured(handler, request, inputs, log);
+
+      lastRequest = request;
+      hasLastRequest = true;
+      //the request just regenerated everything
+      inputsChanged = false;
+
+      if(watch){
+        watcher.Watch(inputs);
+      }
+    }else{
+      log = "Received a bad request\n";
+    }
+
+    WriteAll(clientFd, std::to_string(exitCode) + "\n" + log);
+    close(clientFd);
+  }
+
+  close(listenFd);
+  unlink(socketPath.c_str());
+
+  return 1;
+}
+
+int RunClient(const std::string& socketPath, const GenerateRequest& request){
+
+  sockaddr_un address;
+
+  if(!GetSocketAddress(socketPath, address)){
+    return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if(fd == -1){
+    return -1;
+  }
+
+  if(connect(fd, (sockaddr*)&address, sizeof(address)) != 0){
+    close(fd);
+    return -1;
+  }
+
+  if(!IsPeerSameUser(fd)){
+    std::cout << "Ignoring the server on " << socketPath << " since it's run by another user\n";
+    close(fd);
+    return -1;
+  }
+
+  std::ostringstream requestData(std::ios::binary);
+  request.Save(requestData);
+
+  string reply;
+
+  if(!WriteAll(fd, requestData.str()) || shutdown(fd, SHUT_WR) != 0 || !ReadAll(fd, reply)){
+    close(fd);
+    return -1;
+  }
+
+  close(fd);
+
+  size_t end = reply.find('\n');
+
+  if(end == string::npos){
+    return -1;
+  }
+
+  std::cout << reply.substr(end+1);
+
+  return atoi(reply.substr(0, end).c_str());
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+//Everything needed to regenerate one output file, the client sends one of these to the server for each run
+struct GenerateRequest{
+  GenerateRequest() : JobCount(1), UsePrefixHeader(false), DeclarationsOnly(false), Verbose(false), UseSharedFiles(false),
+                      RegistrationTables(false), RegistrationStream(false), SplitOutput(false), LazyObjects(false), DenseRecorders(false),
+                      PrehashKeys(false){
+  }
+
+  std::string WorkingDir;
+  std::string OutputFile;
+  //empty when no depfile should be written
+  std::string DepFile;
+  std::vector<std::string> Sources;
+  std::vector<std::string> Includes;
+  //arguments passed to clang after --
+  std::vector<std::string> CompilerArgs;
+  //options of the client that change how the sources are parsed, a server uses these instead of its own
+  unsigned JobCount;
+  bool UsePrefixHeader, DeclarationsOnly;
+  std::vector<std::string> PrefixIncludes;
+  bool Verbose, UseSharedFiles;
+  //options of the client that pick the registration emitter and what it writes
+  bool RegistrationTables, RegistrationStream, SplitOutput, LazyObjects, DenseRecorders, PrehashKeys;
+
+  void Save(std::ostream& output) const;
+  bool Load(std::istream& input);
+};
+
+//Runs the generator for a request and fills inputs with the sources and headers it read, returns the exit code
+typedef std::function<int(const GenerateRequest& request, std::vector<std::string>& inputs)> GenerateHandler;
+
+//Serve requests on a Unix socket until the process is killed. With watch the inputs of the last request are
+//watched with inotify and the request is run again as soon as one of them changes so the next run is all cache hits
+int RunServer(const std::string& socketPath, bool watch, bool verbose, const GenerateHandler& handler);
+
+//Send a request to the server and print what it printed while running it, returns the exit code of the
+//request or -1 if no server could be reached or it isn't run by the same user
+int RunClient(const std::string& socketPath, const GenerateRequest& request);
+
+//A socket in $XDG_RUNTIME_DIR or otherwise in a directory only the user can access in the temp directory
+std::string GetDefaultSocketPath();
@@ -0,0 +1,183 @@
+#include "SharedFileOverlay.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+
+using clang::vfs::Status;
+using llvm::ErrorOr;
+using llvm::Twine;
+
+class SharedFileOverlay::OverlayFile : public clang::vfs::File{
+
+public:
+  OverlayFile(SharedFileOverlay& owner, const Status& stat, const llvm::MemoryBuffer& contents) :
+    Owner(owner), Stat(stat), Contents(contents){
+  }
+
+  ErrorOr<Status> status() override{
+    return Stat;
+  }
+
+  ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(const Twine& name, int64_t fileSize, bool requiresNullTerminator, bool isVolatile) override{
+    Owner.BytesServed += Contents.getBufferSize();
+
+    //the shared copy was loaded with a null terminator so it can always be handed out without copying it
+    return llvm::MemoryBuffer::getMemBuffer(Contents.getBuffer(), name.str(), requiresNullTerminator);
+  }
+
+  std::error_code close() override{
+    return std::error_code();
+  }
+
+private:
+  SharedFileOverlay& Owner;
+  Status Stat;
+  const llvm::MemoryBuffer& Contents;
+};
+
+SharedFileOverlay::SharedFileOverlay(llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> base) :
+  Base(base), BytesReadFromDisk(0), BytesServed(0), FileCount(0), UniqueContentCount(0){
+}
+
+std::string SharedFileOverlay::GetKey(const Twine& path){
+
+  llvm::SmallString<256> key;
+  path.toVector(key);
+  llvm::sys::fs::make_absolute(key);
+
+  return key.str();
+}
+
+void SharedFileOverlay::Preload(const std::vector<std::string>& paths){
+
+  for(auto& path : paths){
+    ErrorOr<Status> stat = status(path);
+
+    if(stat && stat->isRegularFile()){
+      LoadContents(GetKey(path), *stat);
+    }
+  }
+}
+
+ErrorOr<Status> SharedFileOverlay::status(const Twine& path){
+
+  std::string key = GetKey(path);
+  ErrorOr<Status> stat = std::make_error_code(std::errc::no_such_file_or_directory);
+  bool found = false;
+
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    auto it = Files.find(key);
+
+    if(it != Files.end() && it->second.HasStat){
+      stat = it->second.Stat;
+      found = true;
+    }
+  }
+
+  if(!found){
+    stat = Base->status(key);
+
+    std::lock_guard<std::mutex> lock(Lock);
+    FileEntry& entry = Files[key];
+
+    if(!entry.HasStat){
+      entry.Stat = stat;
+      entry.HasStat = true;
+    }
+  }
+
+  if(!stat){
+    return stat;
+  }
+
+  //report the file under the name it was asked for like the real file system does
+  return Status::copyWithNewName(*stat, path.str());
+}
+
+const llvm::MemoryBuffer* SharedFileOverlay::LoadContents(const std::string& key, const Status& stat){
+
+  {
+    std::lock_guard<std::mutex> lock(Lock);
+    auto it = Files.find(key);
+
+    if(it != Files.end() && it->second.Contents != NULL){
+      return it->second.Contents;
+    }
+  }
+
+  //read outside the lock so workers only wait on each other when they need the same file
+  auto file = Base->openFileForRead(key);
+
+  if(!file){
+    return NULL;
+  }
+
+  auto buffer = (*file)->getBuffer(key, stat.getSize(), true, false);
+
+  if(!buffer){
+    return NULL;
+  }
+
+  BytesReadFromDisk += (*buffer)->getBufferSize();
+
+  llvm::MD5 hash;
+  llvm::MD5::MD5Result result;
+  llvm::SmallString<32> contentHash;
+
+  hash.update((*buffer)->getBuffer());
+  hash.final(result);
+  llvm::MD5::stringifyResult(result, contentHash);
+
+  std::lock_guard<std::mutex> lock(Lock);
+  FileEntry& entry = Files[key];
+
+  //another worker loaded it while we were reading
+  if(entry.Contents != NULL){
+    return entry.Contents;
+  }
+
+  std::unique_ptr<llvm::MemoryBuffer>& contents = Contents[contentHash];
+
+  if(!contents){
+    contents = std::move(*buffer);
+    UniqueContentCount++;
+  }
+
+  entry.Contents = contents.get();
+  FileCount++;
+
+  return entry.Contents;
+}
+
+ErrorOr<std::unique_ptr<clang::vfs::File>> SharedFileOverlay::openFileForRead(const Twine& path){
+
+  std::string key = GetKey(path);
+  ErrorOr<Status> stat = status(key);
+
+  if(!stat){
+    return stat.getError();
+  }
+
+  const llvm::MemoryBuffer* contents = stat->isRegularFile() ? LoadContents(key, *stat) : NULL;
+
+  //leave anything we couldn't load to the real file system so it reports the error
+  if(contents == NULL){
+    return Base->openFileForRead(path);
+  }
+
+  return std::unique_ptr<clang::vfs::File>(new OverlayFile(*this, Status::copyWithNewName(*stat, path.str()), *contents));
+}
+
+clang::vfs::directory_iterator SharedFileOverlay::dir_begin(const Twine& dir, std::error_code& ec){
+  return Base->dir_begin(dir, ec);
+}
+
+ErrorOr<std::string> SharedFileOverlay::getCurrentWorkingDirectory() const{
+  return Base->getCurrentWorkingDirectory();
+}
+
+std::error_code SharedFileOverlay::setCurrentWorkingDirectory(const Twine& path){
+  return Base->setCurrentWorkingDirectory(path);
+}
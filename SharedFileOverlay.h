@@ -0,0 +1,73 @@
+#pragma once
+
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//File system shared by every worker that reads each source and header from disk once and serves every later read
+//from memory. Files are keyed by content hash so identical copies of a header are only kept once, and once a file
+//is loaded it never changes for the rest of the run. Buffers handed to clang reference the shared memory directly
+class SharedFileOverlay : public clang::vfs::FileSystem{
+
+public:
+  explicit SharedFileOverlay(llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> base = clang::vfs::getRealFileSystem());
+
+  //Load the files upfront so the workers never wait on each other to read them
+  void Preload(const std::vector<std::string>& paths);
+
+  llvm::ErrorOr<clang::vfs::Status> status(const llvm::Twine& path) override;
+  llvm::ErrorOr<std::unique_ptr<clang::vfs::File>> openFileForRead(const llvm::Twine& path) override;
+  clang::vfs::directory_iterator dir_begin(const llvm::Twine& dir, std::error_code& ec) override;
+
+  llvm::ErrorOr<std::string> getCurrentWorkingDirectory() const override;
+  std::error_code setCurrentWorkingDirectory(const llvm::Twine& path) override;
+
+  uint64_t GetBytesReadFromDisk() const{
+    return BytesReadFromDisk;
+  }
+
+  uint64_t GetBytesServed() const{
+    return BytesServed;
+  }
+
+  unsigned GetFileCount() const{
+    return FileCount;
+  }
+
+  unsigned GetUniqueContentCount() const{
+    return UniqueContentCount;
+  }
+
+private:
+  struct FileEntry{
+    FileEntry() : Stat(std::make_error_code(std::errc::no_such_file_or_directory)), Contents(NULL), HasStat(false){
+    }
+
+    llvm::ErrorOr<clang::vfs::Status> Stat;
+    const llvm::MemoryBuffer* Contents;
+    bool HasStat;
+  };
+
+  class OverlayFile;
+
+  static std::string GetKey(const llvm::Twine& path);
+  const llvm::MemoryBuffer* LoadContents(const std::string& key, const clang::vfs::Status& stat);
+
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> Base;
+
+  std::mutex Lock;
+  //path to the status and contents of the file, failed lookups are kept too since header search checks
+  //the same missing paths for every source file
+  llvm::StringMap<FileEntry> Files;
+  //content hash to the one copy of it in memory
+  llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> Contents;
+
+  std::atomic<uint64_t> BytesReadFromDisk, BytesServed;
+  std::atomic<unsigned> FileCount, UniqueContentCount;
+};
@@ -0,0 +1,177 @@
+#include "TimeTrace.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+using std::string;
+using llvm::StringRef;
+
+TimeTrace::TimeTrace() : StartTime(std::chrono::steady_clock::now()){
+}
+
+uint64_t TimeTrace::Now() const{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-StartTime).count();
+}
+
+void TimeTrace::AddEvent(StringRef name, StringRef detail, uint64_t start, uint64_t end, const EventArgs& args){
+
+  std::lock_guard<std::mutex> lock(Lock);
+
+  auto threadId = ThreadIds.insert(std::make_pair(std::this_thread::get_id(), (unsigned)ThreadIds.size()));
+
+  Event event;
+  event.Name = name;
+  event.Detail = detail;
+  event.Start = start;
+  event.Duration = end-start;
+  event.ThreadId = threadId.first->second;
+  event.Args = args;
+  Events.push_back(std::move(event));
+
+  auto phase = Phases.insert(std::make_pair(name, PhaseTotal()));
+
+  if(phase.second){
+    PhaseOrder.push_back(name);
+  }
+
+  phase.first->second.Duration += end-start;
+  phase.first->second.Count++;
+}
+
+void TimeTrace::AddPhaseTime(StringRef name, uint64_t duration){
+
+  std::lock_guard<std::mutex> lock(Lock);
+
+  auto phase = Phases.insert(std::make_pair(name, PhaseTotal()));
+
+  if(phase.second){
+    PhaseOrder.push_back(name);
+  }
+
+  phase.first->second.Duration += duration;
+  phase.first->second.Count++;
+}
+
+static void WriteJSONString(std::ostream& output, StringRef value){
+
+  output << '"';
+
+  for(char c : value){
+    switch(c){
+      case '"':
+        output << "\\\"";
+        break;
+      case '\\':
+        output << "\\\\";
+        break;
+      case '\n':
+        output << "\\n";
+        break;
+      default:
+        if((unsigned char)c < 0x20){
+          output << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+        }else{
+          output << c;
+        }
+    }
+  }
+
+  output << '"';
+}
+
+bool TimeTrace::WriteChromeTrace(const string& path) const{
+
+  std::lock_guard<std::mutex> lock(Lock);
+  std::ofstream output(path, std::ios::binary);
+
+  if(!output){
+    return false;
+  }
+
+  output << "{\"traceEvents\":[\n";
+
+  bool first = true;
+
+  for(auto& event : Events){
+    output << (first ? "" : ",\n") << "{\"name\":";
+    WriteJSONString(output, event.Name);
+    output << ",\"cat\":\"buildvm_clang\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.ThreadId;
+    output << ",\"ts\":" << event.Start << ",\"dur\":" << event.Duration << ",\"args\":{";
+
+    bool firstArg = true;
+
+    if(!event.Detail.empty()){
+      output << "\"detail\":";
+      WriteJSONString(output, event.Detail);
+      firstArg = false;
+    }
+
+    for(auto& arg : event.Args){
+      output << (firstArg ? "" : ",");
+      WriteJSONString(output, arg.first);
+      output << ":" << arg.second;
+      firstArg = false;
+    }
+
+    output << "}}";
+    first = false;
+  }
+
+  for(auto& thread : ThreadIds){
+    output << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.second;
+    output << ",\"args\":{\"name\":\"" << (thread.second == 0 ? "main" : "worker") << " " << thread.second << "\"}}";
+    first = false;
+  }
+
+  output << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+  return output.good();
+}
+
+void TimeTrace::PrintSummary(std::ostream& output) const{
+
+  std::lock_guard<std::mutex> lock(Lock);
+
+  std::ios::fmtflags flags = output.flags();
+  std::streamsize precision = output.precision();
+
+  output << std::fixed << std::setprecision(2);
+  output << "\n===-------------------------------------------------------------------------===\n";
+  output << "                              Time trace summary\n";
+  output << "===-------------------------------------------------------------------------===\n";
+  output << std::setw(12) << "Total (ms)" << std::setw(10) << "Count" << std::setw(12) << "Avg (ms)" << "  Phase\n";
+
+  for(auto& name : PhaseOrder){
+    const PhaseTotal& phase = Phases.find(name)->second;
+    double total = phase.Duration/1000.0;
+
+    output << std::setw(12) << total << std::setw(10) << phase.Count << std::setw(12) << (total/phase.Count) << "  " << name << "\n";
+  }
+
+  //the slowest source files are usually the first place to look for a regression
+  std::vector<const Event*> sources;
+
+  for(auto& event : Events){
+    if(event.Name == "Source"){
+      sources.push_back(&event);
+    }
+  }
+
+  std::sort(sources.begin(), sources.end(), [](const Event* a, const Event* b){
+    return a->Duration > b->Duration;
+  });
+
+  if(!sources.empty()){
+    output << "\nSlowest source files:\n";
+  }
+
+  for(size_t i = 0; i < sources.size() && i < 10 ;i++){
+    output << std::setw(12) << (sources[i]->Duration/1000.0) << "  " << sources[i]->Detail << "\n";
+  }
+
+  output.flags(flags);
+  output.precision(precision);
+  output.flush();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//Records where the time of a run went for -time-trace, events can be added from any worker thread. The events are
+//written as a Chrome trace and summed up per phase for the summary table
+class TimeTrace{
+
+public:
+  //extra values shown with an event, times should have their unit in the name
+  typedef std::vector<std::pair<std::string, uint64_t>> EventArgs;
+
+  TimeTrace();
+
+  //Microseconds since the trace was created
+  uint64_t Now() const;
+
+  void AddEvent(llvm::StringRef name, llvm::StringRef detail, uint64_t start, uint64_t end, const EventArgs& args = EventArgs());
+
+  //Time spent in a phase thats interleaved with other work so it has no single interval in the trace,
+  //like the time spent in preprocessor callbacks while parsing
+  void AddPhaseTime(llvm::StringRef phase, uint64_t duration);
+
+  bool WriteChromeTrace(const std::string& path) const;
+  void PrintSummary(std::ostream& output) const;
+
+private:
+  struct Event{
+    std::string Name, Detail;
+    uint64_t Start, Duration;
+    unsigned ThreadId;
+    EventArgs Args;
+  };
+
+  struct PhaseTotal{
+    PhaseTotal() : Duration(0), Count(0){
+    }
+
+    uint64_t Duration;
+    unsigned Count;
+  };
+
+  std::chrono::steady_clock::time_point StartTime;
+
+  mutable std::mutex Lock;
+  std::vector<Event> Events;
+  std::vector<std::string> PhaseOrder;
+  llvm::StringMap<PhaseTotal> Phases;
+  std::map<std::thread::id, unsigned> ThreadIds;
+};
+
+//Adds an event for the time from construction to destruction, does nothing when trace is NULL
+class TimeTraceScope{
+
+public:
+  TimeTraceScope(TimeTrace* trace, llvm::StringRef name, llvm::StringRef detail = llvm::StringRef()) :
+    Trace(trace), Name(name), Detail(detail), Start(trace ? trace->Now() : 0){
+  }
+
+  ~TimeTraceScope(){
+    if(Trace != NULL){
+      Trace->AddEvent(Name, Detail, Start, Trace->Now());
+    }
+  }
+
+private:
+  TimeTrace* Trace;
+  llvm::StringRef Name, Detail;
+  uint64_t Start;
+};
+
+//Adds the time from construction to destruction to a running total
+class TimeTraceAccumulator{
+
+public:
+  TimeTraceAccumulator(const TimeTrace* trace, uint64_t& total) :
+    Trace(trace), Total(total), Start(trace ? trace->Now() : 0){
+  }
+
+  ~TimeTraceAccumulator(){
+    if(Trace != NULL){
+      Total += Trace->Now()-Start;
+    }
+  }
+
+private:
+  const TimeTrace* Trace;
+  uint64_t& Total;
+  uint64_t Start;
+};
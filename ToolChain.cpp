@@ -0,0 +1,400 @@
+#include "ToolChain.h"
+#include "OutputFile.h"
+
+#include "clang/Basic/Version.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using std::string;
+using llvm::StringRef;
+
+//bump this when the layout of the toolchain cache changes
+static const char ToolChainFormat[] = "buildvm_clang-toolchain 3";
+
+string GetDefaultToolChainTriple(){
+#if defined(_WIN32)
+  //LuaJIT's Windows build this was written for is 32 bit, a 64 bit LLVM would otherwise parse the sources as x86_64
+  return "i386-pc-win32";
+#else
+  return llvm::sys::getDefaultTargetTriple();
+#endif
+}
+
+#if defined(_WIN32)
+extern void GetWindowsSystemIncludes(std::vector<std::string>& includes, const std::string& windowsSDKVer, const char* vsVersion);
+#endif
+
+static string HashString(StringRef data){
+
+  llvm::MD5 hash;
+  llvm::MD5::MD5Result result;
+  llvm::SmallString<32> hexResult;
+
+  hash.update(data);
+  hash.final(result);
+  llvm::MD5::stringifyResult(result, hexResult);
+
+  return hexResult.str();
+}
+
+static string GetEnv(const char* name){
+  const char* value = getenv(name);
+  return value ? value : "";
+}
+
+#if defined(_WIN32)
+
+static string GetProbeKey(const string& windowsSDKVer, const string& vsVersion){
+  return HashString(GetEnv("INCLUDE") + '\n' + GetEnv("VCINSTALLDIR") + '\n' + windowsSDKVer + '\n' + vsVersion);
+}
+
+static bool ProbeHost(ToolChainInfo& toolChain, const string& windowsSDKVer, const string& vsVersion){
+
+  GetWindowsSystemIncludes(toolChain.SystemIncludes, windowsSDKVer, vsVersion.empty() ? NULL : vsVersion.c_str());
+  toolChain.Triple = GetDefaultToolChainTriple();
+
+  return !toolChain.SystemIncludes.empty();
+}
+
+#else
+
+//The host C++ compiler, CXX is used if its set so the headers match the compiler the project is built with
+static string FindHostCompiler(){
+
+  string compiler = GetEnv("CXX");
+
+  if(!compiler.empty() && llvm::sys::fs::exists(compiler)){
+    return compiler;
+  }
+
+  for(const char* name : {compiler.c_str(), "c++", "clang++", "g++"}){
+    if(*name == 0){
+      continue;
+    }
+
+    auto path = llvm::sys::findProgramByName(name);
+
+    if(path){
+      return *path;
+    }
+  }
+
+  return "";
+}
+
+static string GetProbeKey(const string& windowsSDKVer, const string& vsVersion){
+
+  string compiler = FindHostCompiler();
+  llvm::sys::fs::file_status status;
+
+  //a compiler upgrade changes its timestamp and can move its headers
+  if(!compiler.empty() && !llvm::sys::fs::status(compiler, status)){
+    compiler += '\n' + std::to_string(status.getLastModificationTime().toEpochTime());
+  }
+
+  return HashString(compiler);
+}
+
+//Run the compiler and return what it wrote to stdout or stderr
+static bool RunCompiler(const string& compiler, std::vector<const char*> args, bool readStdErr, string& output){
+
+  llvm::SmallString<128> outputPath;
+
+  if(llvm::sys::fs::createTemporaryFile("buildvm_clang-probe", "txt", outputPath)){
+    return false;
+  }
+
+  StringRef outputFile = outputPath.str();
+  StringRef emptyFile;
+  const StringRef* redirects[] = {&emptyFile, readStdErr ? &emptyFile : &outputFile, readStdErr ? &outputFile : &emptyFile};
+
+  args.insert(args.begin(), compiler.c_str());
+  args.push_back(NULL);
+
+  int result = llvm::sys::ExecuteAndWait(compiler, args.data(), NULL, redirects);
+  auto buffer = llvm::MemoryBuffer::getFile(outputPath);
+
+  if(buffer){
+    output = (*buffer)->getBuffer();
+  }
+
+  llvm::sys::fs::remove(outputPath);
+
+  return result == 0 && buffer;
+}
+
+//GCC and Clang both print their include search list for -v between these two lines
+static void ParseIncludeList(StringRef output, std::vector<string>& includes){
+
+  size_t start = output.find("#include <...> search starts here:");
+  size_t end = output.find("End of search list.");
+
+  if(start == StringRef::npos || end == StringRef::npos || end < start){
+    return;
+  }
+
+  StringRef list = output.slice(output.find('\n', start), end);
+
+  while(!list.empty()){
+    auto split = list.split('\n');
+    StringRef line = split.first.trim();
+    list = split.second;
+
+    //Darwin lists framework directories in the same list
+    if(line.empty() || line.endswith("(framework directory)")){
+      continue;
+    }
+
+    //the compiler's own intrinsic headers only work with that compiler, clang uses the ones in ResourceDir
+    if(line.find("/lib/clang/") != StringRef::npos || 
+       (line.find("/lib/gcc/") != StringRef::npos && (line.endswith("/include") || line.endswith("/include-fixed")))){
+      continue;
+    }
+
+    includes.push_back(line);
+  }
+}
+
+static bool IsResourceDir(StringRef path){
+
+  llvm::SmallString<256> stddefPath(path);
+  llvm::sys::path::append(stddefPath, "include", "stddef.h");
+
+  return llvm::sys::fs::exists(stddefPath);
+}
+
+//The builtin headers have to come from the same clang version we're linked against. The tooling driver doesn't
+//reliably find the ones next to our executable and an installed generator has none there, so a clang of the same
+//version is asked where its headers are
+static string FindResourceDir(const string& hostCompiler){
+
+  string version = CLANG_VERSION_STRING;
+  string major = std::to_string(CLANG_VERSION_MAJOR);
+  string executable = llvm::sys::fs::getMainExecutable(NULL, (void*)&FindResourceDir);
+
+  if(!executable.empty()){
+    llvm::SmallString<256> path(llvm::sys::path::parent_path(llvm::sys::path::parent_path(executable)));
+    llvm::sys::path::append(path, "lib", "clang", version);
+
+    if(IsResourceDir(path)){
+      return path.str();
+    }
+  }
+
+  std::vector<string> compilers = {hostCompiler};
+
+  for(const string& name : {"clang-" + major + "." + std::to_string(CLANG_VERSION_MINOR), "clang-" + major, string("clang")}){
+    auto path = llvm::sys::findProgramByName(name);
+
+    if(path){
+      compilers.push_back(*path);
+    }
+  }
+
+  string output;
+
+  for(auto& compiler : compilers){
+    //GCC doesn't know the option and fails
+    if(compiler.empty() || !RunCompiler(compiler, {"-print-resource-dir"}, false, output)){
+      continue;
+    }
+
+    StringRef resourceDir = StringRef(output).trim();
+    StringRef dirVersion = llvm::sys::path::filename(resourceDir);
+
+    //newer releases only name the directory after the major version
+    if((dirVersion == version || dirVersion == major) && IsResourceDir(resourceDir)){
+      return resourceDir;
+    }
+  }
+
+  return "";
+}
+
+static bool ProbeHost(ToolChainInfo& toolChain, const string& windowsSDKVer, const string& vsVersion){
+
+  string compiler = FindHostCompiler();
+  string output;
+
+  if(compiler.empty()){
+    return false;
+  }
+
+  if(RunCompiler(compiler, {"-E", "-x", "c++", "-v", "/dev/null"}, true, output)){
+    ParseIncludeList(output, toolChain.SystemIncludes);
+  }
+
+  if(RunCompiler(compiler, {"-dumpmachine"}, false, output) && !StringRef(output).trim().empty()){
+    toolChain.Triple = StringRef(output).trim();
+  }else{
+    toolChain.Triple = llvm::sys::getDefaultTargetTriple();
+  }
+
+  toolChain.ResourceDir = FindResourceDir(compiler);
+
+  return !toolChain.SystemIncludes.empty();
+}
+
+#endif
+
+static bool LoadToolChain(ToolChainInfo& toolChain, const string& cacheFile, const string& probeKey){
+
+  std::ifstream input(cacheFile, std::ios::binary);
+  string line;
+  size_t count;
+
+  if(!input || !std::getline(input, line) || line != ToolChainFormat || !std::getline(input, line) || line != probeKey ||
+     !std::getline(input, toolChain.Triple) || !std::getline(input, toolChain.ResourceDir) || !(input >> count) || input.get() != '\n'){
+    return false;
+  }
+
+  if(!toolChain.ResourceDir.empty() && !llvm::sys::fs::is_directory(toolChain.ResourceDir)){
+    return false;
+  }
+
+  toolChain.SystemIncludes.clear();
+
+  for(size_t i = 0; i != count ;i++){
+    //a removed SDK or compiler install means the paths have to be probed again
+    if(!std::getline(input, line) || !llvm::sys::fs::is_directory(line)){
+      return false;
+    }
+
+    toolChain.SystemIncludes.push_back(line);
+  }
+
+  toolChain.ProbeKey = probeKey;
+
+  return true;
+}
+
+//written to a temporary file and renamed so a crash or another run at the same time never leaves half of it
+static void SaveToolChain(const ToolChainInfo& toolChain, const string& cacheFile){
+
+  std::ostringstream output(std::ios::binary);
+
+  output << ToolChainFormat << '\n' << toolChain.ProbeKey << '\n' << toolChain.Triple << '\n' << toolChain.ResourceDir << '\n';
+  output << toolChain.SystemIncludes.size() << '\n';
+
+  for(auto& path : toolChain.SystemIncludes){
+    output << path << '\n';
+  }
+
+  WriteFileIfChanged(cacheFile, output.str());
+}
+
+bool ResolveToolChain(ToolChainInfo& toolChain, const string& cacheFile, const string& windowsSDKVer, const string& vsVersion, bool verbose){
+
+  string probeKey = GetProbeKey(windowsSDKVer, vsVersion);
+
+  if(!cacheFile.empty() && LoadToolChain(toolChain, cacheFile, probeKey)){
+    if(verbose){
+      std::cout << "Using cached toolchain for " << toolChain.Triple << " from " << cacheFile << "\n";
+    }
+    return true;
+  }
+
+  toolChain = ToolChainInfo();
+  toolChain.ProbeKey = probeKey;
+
+  bool found = ProbeHost(toolChain, windowsSDKVer, vsVersion);
+
+  if(toolChain.Triple.empty()){
+    toolChain.Triple = GetDefaultToolChainTriple();
+  }
+
+  if(!found){
+    return false;
+  }
+
+  if(verbose){
+    std::cout << "Probed toolchain for " << toolChain.Triple << " with " << toolChain.SystemIncludes.size() << " system include directories\n";
+  }
+
+  if(!cacheFile.empty()){
+    SaveToolChain(toolChain, cacheFile);
+  }
+
+  return true;
+}
+
+void ApplyToolChain(const ToolChainInfo& toolChain, clang::HeaderSearchOptions& headerSearch){
+
+  //make sure the Visual Studio include directory we found is used rather than one passed on the command line
+  for(auto it = headerSearch.UserEntries.begin(); it != headerSearch.UserEntries.end(); it++){
+
+    if(it->Path.find("\\VC\\include") != -1){
+      headerSearch.UserEntries.erase(it);
+      break;
+    }
+  }
+
+  for(auto& path : toolChain.SystemIncludes){
+    headerSearch.AddPath(path, clang::frontend::System, false, false);
+  }
+
+  if(!toolChain.ResourceDir.empty()){
+    headerSearch.ResourceDir = toolChain.ResourceDir;
+  }
+}
+
+struct TargetInitializers{
+  const char* Name;
+  void (*InitializeTargetInfo)();
+  void (*InitializeTargetMC)();
+};
+
+struct AsmParserInitializer{
+  const char* Name;
+  void (*InitializeAsmParser)();
+};
+
+void InitializeToolChainTargets(const ToolChainInfo& toolChain){
+
+  static const TargetInitializers targets[] = {
+#define LLVM_TARGET(TargetName) {#TargetName, LLVMInitialize##TargetName##TargetInfo, LLVMInitialize##TargetName##TargetMC},
+#include "llvm/Config/Targets.def"
+  };
+
+  //the asm parser is needed for MS style inline asm blocks in the headers
+  static const AsmParserInitializer asmParsers[] = {
+#define LLVM_ASM_PARSER(TargetName) {#TargetName, LLVMInitialize##TargetName##AsmParser},
+#include "llvm/Config/AsmParsers.def"
+  };
+
+  //getArchTypePrefix gives the same name LLVM gives the target for the arch, like x86 for both i686 and x86_64
+  StringRef targetName = llvm::Triple::getArchTypePrefix(llvm::Triple(toolChain.Triple).getArch());
+  bool found = false;
+
+  for(auto& target : targets){
+    if(targetName.equals_lower(target.Name)){
+      target.InitializeTargetInfo();
+      target.InitializeTargetMC();
+      found = true;
+    }
+  }
+
+  for(auto& asmParser : asmParsers){
+    if(targetName.equals_lower(asmParser.Name)){
+      asmParser.InitializeAsmParser();
+    }
+  }
+
+  if(!found){
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+  }
+}
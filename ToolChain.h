@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace clang{
+  class HeaderSearchOptions;
+}
+
+//System include directories and target triple of the host toolchain, these are resolved once per run and
+//saved to a cache file so later runs don't have to probe the host again
+struct ToolChainInfo{
+  //hash of everything the probe depended on, a saved toolchain is only reused when it matches
+  std::string ProbeKey;
+  std::string Triple;
+  std::vector<std::string> SystemIncludes;
+  //clang's builtin headers like stddef.h and the intrinsics, empty to let clang look next to the executable
+  std::string ResourceDir;
+};
+
+//Load the toolchain from cacheFile if its still valid otherwise probe the host and save the result to it,
+//the Windows SDK and Visual Studio versions are only used when probing a Windows host
+bool ResolveToolChain(ToolChainInfo& toolChain, const std::string& cacheFile, const std::string& windowsSDKVer,
+                      const std::string& vsVersion, bool verbose);
+
+//The triple used when the host toolchain doesn't give one, i386-pc-win32 on Windows
+std::string GetDefaultToolChainTriple();
+
+void ApplyToolChain(const ToolChainInfo& toolChain, clang::HeaderSearchOptions& headerSearch);
+
+//Only register the LLVM target the triple needs instead of every target LLVM was built with
+void InitializeToolChainTargets(const ToolChainInfo& toolChain);
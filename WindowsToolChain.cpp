@@ -13,7 +13,6 @@
 #include "clang/Basic/Version.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/Path.h"
-#include "clang/Lex/HeaderSearchOptions.h"
 
 #include "llvm/Support/FileSystem.h"
 
@@ -276,15 +275,13 @@ static bool getVisualStudioDir(std::string &path, const char* version = NULL) {
 }
 
 
-void addSystemInclude(clang::HeaderSearchOptions& headerSearchOptions, std::string& path){
-  headerSearchOptions.AddPath(path, clang::frontend::System, false, false);
+static void addSystemInclude(std::vector<std::string>& includes, StringRef path){
+  includes.push_back(path);
 }
 
-void addSystemInclude(clang::HeaderSearchOptions& headerSearchOptions, StringRef& path){
-  headerSearchOptions.AddPath(path, clang::frontend::System, false, false);
-}
-
-void AddClangSystemIncludeArgs(clang::HeaderSearchOptions& headerSearch, const std::string& windowsSDKVer, const char* vsVersion) {
+//Find the system include directories of the Visual Studio and Windows SDK install, this walks the registry
+//so its only called when the toolchain cache doesn't have them yet
+void GetWindowsSystemIncludes(std::vector<std::string>& includes, const std::string& windowsSDKVer, const char* vsVersion) {
 
 #ifdef _MSC_VER
   // Honor %INCLUDE%. It should know essential search paths with vcvarsall.bat.
@@ -298,7 +295,7 @@ void AddClangSystemIncludeArgs(clang::HeaderSearchOptions& headerSearch, const s
       if (d.size() == 0)
         continue;
       ++n;
-      addSystemInclude(headerSearch, d);
+      addSystemInclude(includes, d);
     }
     if (n) return;
   }
@@ -306,15 +303,6 @@ void AddClangSystemIncludeArgs(clang::HeaderSearchOptions& headerSearch, const s
   std::string VSDir;
   std::string WindowsSDKDir;
 
-  for (auto it = headerSearch.UserEntries.begin(); it != headerSearch.UserEntries.end(); it++){
-
-    if(it->Path.find("\\VC\\include") != -1){
-      headerSearch.UserEntries.erase(it);
-      break;
-    }
-  }
-
-
   if(!windowsSDKVer.empty()){
     getSystemRegistryString(std::string("HKEY_LOCAL_MACHINE\\SOFTWARE\\Microsoft\\Microsoft SDKs\\Windows\\")+windowsSDKVer,
                                "InstallationFolder", WindowsSDKDir, "include");
@@ -323,15 +311,15 @@ void AddClangSystemIncludeArgs(clang::HeaderSearchOptions& headerSearch, const s
   // When built with access to the proper Windows APIs, try to actually find
   // the correct include paths first.
   if (getVisualStudioDir(VSDir, vsVersion)) {
-    addSystemInclude(headerSearch, VSDir + "\\VC\\include");
+    addSystemInclude(includes, VSDir + "\\VC\\include");
     
     if(WindowsSDKDir.empty())getWindowsSDKDir(WindowsSDKDir);
     if(WindowsSDKDir.back() == '\\' || WindowsSDKDir.back() == '/')WindowsSDKDir.pop_back();
 
     if(!WindowsSDKDir.empty()){
-      addSystemInclude(headerSearch, WindowsSDKDir + "\\include");
+      addSystemInclude(includes, WindowsSDKDir + "\\include");
     }else
-      addSystemInclude(headerSearch, VSDir + "\\VC\\PlatformSDK\\Include");
+      addSystemInclude(includes, VSDir + "\\VC\\PlatformSDK\\Include");
     return;
   }
 #endif // _MSC_VER